@@ -1,6 +1,7 @@
 #include <vector>
 #include <cstdint>
 #include <stdexcept>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <filesystem>
@@ -122,11 +123,56 @@ void convertCMPRToDXT1(std::vector<uint8_t>& data, int width, int height)
     std::memcpy(data.data(), data64.data(), blockCount * sizeof(uint64_t));
 }
 
+// Converts a GCT0 CMPR texture that is already in memory into a full DXT1 DDS file (header + blocks).
+// Returns an empty buffer for image types that aren't CMPR.
+std::vector<unsigned char> GCT0CMPRBufferToDXT1DDS(const unsigned char* buf_ptr, size_t size)
+{
+    std::vector<unsigned char> out_buf;
+
+    if (size < 64)
+    {
+        throw std::runtime_error("GCT0 header is truncated");
+    }
+
+    unsigned char image_type = *(buf_ptr + 7);
+    unsigned char width_byte1 = *(buf_ptr + 8);
+    unsigned char width_byte2 = *(buf_ptr + 9);
+    unsigned char height_byte1 = *(buf_ptr + 10);
+    unsigned char height_byte2 = *(buf_ptr + 11);
+
+    uint16_t width = (static_cast<uint16_t>(width_byte1) << 8) | width_byte2;
+    uint16_t height = (static_cast<uint16_t>(height_byte1) << 8) | height_byte2;
+
+    if (image_type == 0x06)
+    {
+        return out_buf;
+    }
+
+    DDS_HEADER header;
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    header.pitchOrLinearSize = (header.width * header.height) / 2;
+
+    if (size < 64 + static_cast<size_t>(header.pitchOrLinearSize))
+    {
+        throw std::runtime_error("GCT0 texture data is truncated");
+    }
+
+    std::vector<unsigned char> blocks(buf_ptr + 64, buf_ptr + 64 + header.pitchOrLinearSize);
+
+    convertCMPRToDXT1(blocks, width, height);
+
+    out_buf.resize(sizeof(DDS_HEADER));
+    std::memcpy(out_buf.data(), &header, sizeof(DDS_HEADER));
+    out_buf.insert(out_buf.end(), blocks.begin(), blocks.end());
+
+    return out_buf;
+}
+
 void GCT0CMPRToDXT1DDS(const std::filesystem::path& path)
 {
     const std::string out_string = path.stem().string() + ".dds";
     std::vector<unsigned char> buffer;
-    std::vector<unsigned char> out_buf;
 
     // read file into buffer
     {
@@ -146,37 +192,18 @@ void GCT0CMPRToDXT1DDS(const std::filesystem::path& path)
         }
     }
 
-    auto buf_ptr = buffer.data();
-    unsigned char image_type = *(buf_ptr + 7);
-    unsigned char width_byte1 = *(buf_ptr + 8);
-    unsigned char width_byte2 = *(buf_ptr + 9);
-    unsigned char height_byte1 = *(buf_ptr + 10);
-    unsigned char height_byte2 = *(buf_ptr + 11);
-
-    uint16_t width = (static_cast<uint16_t>(width_byte1) << 8) | width_byte2;
-    uint16_t height = (static_cast<uint16_t>(height_byte1) << 8) | height_byte2;
-
-    if (image_type == 0x06)
+    std::vector<unsigned char> out_buf = GCT0CMPRBufferToDXT1DDS(buffer.data(), buffer.size());
+    if (out_buf.empty())
     {
         return;
     }
 
-    DDS_HEADER header;
-    header.width = static_cast<uint32_t>(width);
-    header.height = static_cast<uint32_t>(height);
-    header.pitchOrLinearSize = (header.width * header.height) / 2;
-
-    out_buf.insert(out_buf.end(), buf_ptr + 64, buf_ptr + 64 + header.pitchOrLinearSize);
-
-    convertCMPRToDXT1(out_buf, width, height);
-
     std::ofstream out(out_string, std::ios::binary);
     if (!out)
     {
         throw std::runtime_error("Failed to open output file: " + out_string);
     }
 
-    out.write(reinterpret_cast<char*>(&header), sizeof(DDS_HEADER));
     out.write(reinterpret_cast<char*>(out_buf.data()), out_buf.size());
     
     if (!out)
@@ -0,0 +1,221 @@
+#ifndef BC_DECODER_H
+#define BC_DECODER_H
+
+#include "inc_wrapper.h"
+#include "binary_reader.h"
+#include "texture.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+    #define BC_DECODER_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+// BC1 (DXT1), BC2 (DXT3) and BC3 (DXT5) decoding to RGBA, for previews and for comparing textures.
+// The four colors of a block are interpolated together in one SSE2 register where available; pixels are then table lookups into them.
+
+namespace bc
+{
+    /// <summary>
+    /// The four RGBA colors of a BC1 color block, as little endian RGBA words. Without four_color_only, c0 <= c1 selects the three color + transparent mode
+    /// </summary>
+    void DecodePalette(uint16_t c0, uint16_t c1, bool four_color_only, uint32_t palette[4])
+    {
+        bool four_color = four_color_only || c0 > c1;
+
+#if defined(BC_DECODER_SSE2)
+        auto expand = [](uint16_t color)
+        {
+            int r = ( color >> 11 ) & 31;
+            int g = ( color >> 5 ) & 63;
+            int b = color & 31;
+            return _mm_setr_epi16( static_cast<short>( ( r << 3 ) | ( r >> 2 ) ), static_cast<short>( ( g << 2 ) | ( g >> 4 ) ), static_cast<short>( ( b << 3 ) | ( b >> 2 ) ), 255, 0, 0, 0, 0 );
+        };
+
+        __m128i p0 = expand( c0 );
+        __m128i p1 = expand( c1 );
+        __m128i endpoints = _mm_unpacklo_epi64( p0, p1 );                     // p0 | p1
+        __m128i interpolated;
+        if ( four_color )
+        {
+            // (2 * p0 + p1) / 3 | (p0 + 2 * p1) / 3, dividing by 3 as a multiply by 0xAAAB and a shift by 17
+            __m128i sum = _mm_add_epi16( _mm_add_epi16( endpoints, endpoints ), _mm_unpacklo_epi64( p1, p0 ) );
+            interpolated = _mm_srli_epi16( _mm_mulhi_epu16( sum, _mm_set1_epi16( static_cast<short>( 0xAAAB ) ) ), 1 );
+        }
+        else
+        {
+            // (p0 + p1) / 2 | transparent black
+            interpolated = _mm_srli_epi16( _mm_add_epi16( p0, p1 ), 1 );
+        }
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( palette ), _mm_packus_epi16( endpoints, interpolated ) );
+#else
+        int colors[4][4];
+        auto expand = [](uint16_t color, int rgba[4])
+        {
+            int r = ( color >> 11 ) & 31;
+            int g = ( color >> 5 ) & 63;
+            int b = color & 31;
+            rgba[0] = ( r << 3 ) | ( r >> 2 );
+            rgba[1] = ( g << 2 ) | ( g >> 4 );
+            rgba[2] = ( b << 3 ) | ( b >> 2 );
+            rgba[3] = 255;
+        };
+
+        expand( c0, colors[0] );
+        expand( c1, colors[1] );
+        for ( int channel = 0; channel < 4; ++channel )
+        {
+            colors[2][channel] = four_color ? ( 2 * colors[0][channel] + colors[1][channel] ) / 3 : ( colors[0][channel] + colors[1][channel] ) / 2;
+            colors[3][channel] = four_color ? ( colors[0][channel] + 2 * colors[1][channel] ) / 3 : 0;
+        }
+
+        for ( int i = 0; i < 4; ++i )
+        {
+            palette[i] = static_cast<uint32_t>( colors[i][0] ) | static_cast<uint32_t>( colors[i][1] ) << 8 | static_cast<uint32_t>( colors[i][2] ) << 16 | static_cast<uint32_t>( colors[i][3] ) << 24;
+        }
+#endif
+    }
+
+    /// <summary>
+    /// Decodes an 8-byte color block into 16 RGBA pixels (row by row, 4 bytes each)
+    /// </summary>
+    void DecodeColorBlock(const u8* block, bool four_color_only, u8 pixels[64])
+    {
+        uint32_t palette[4];
+        DecodePalette( binary::load<uint16_t, binary::Endian::Little>( block ), binary::load<uint16_t, binary::Endian::Little>( block + 2 ), four_color_only, palette );
+
+        uint32_t indices = binary::load<uint32_t, binary::Endian::Little>( block + 4 );
+        for ( int i = 0; i < 16; ++i )
+        {
+            std::memcpy( pixels + i * 4, &palette[( indices >> ( i * 2 ) ) & 3], 4 );
+        }
+    }
+
+    /// <summary>
+    /// BC3 alpha block: two endpoints and 3-bit indices into the 8 (or 6 + 0 and 255) values between them
+    /// </summary>
+    void DecodeAlphaBlock(const u8* block, u8 pixels[64])
+    {
+        int a0 = block[0];
+        int a1 = block[1];
+
+        u8 palette[8] = { static_cast<u8>( a0 ), static_cast<u8>( a1 ) };
+        if ( a0 > a1 )
+        {
+            for ( int i = 1; i < 7; ++i )
+            {
+                palette[i + 1] = static_cast<u8>( ( ( 7 - i ) * a0 + i * a1 ) / 7 );
+            }
+        }
+        else
+        {
+            for ( int i = 1; i < 5; ++i )
+            {
+                palette[i + 1] = static_cast<u8>( ( ( 5 - i ) * a0 + i * a1 ) / 5 );
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        uint64_t indices = 0;
+        for ( int i = 0; i < 6; ++i )
+        {
+            indices |= static_cast<uint64_t>( block[2 + i] ) << ( i * 8 );
+        }
+
+        for ( int i = 0; i < 16; ++i )
+        {
+            pixels[i * 4 + 3] = palette[( indices >> ( i * 3 ) ) & 7];
+        }
+    }
+
+    /// <summary>
+    /// BC2 alpha block: 4 bits per pixel, stored as is
+    /// </summary>
+    void DecodeExplicitAlphaBlock(const u8* block, u8 pixels[64])
+    {
+        for ( int i = 0; i < 16; ++i )
+        {
+            int alpha = ( block[i / 2] >> ( ( i & 1 ) * 4 ) ) & 0xF;
+            pixels[i * 4 + 3] = static_cast<u8>( alpha * 17 );
+        }
+    }
+
+    /// <summary>
+    /// Decodes a block compressed image with the given DDS four_cc. Returns false for other formats or if the data is too short
+    /// </summary>
+    bool DecodeImage(const u8* data, size_t size, uint32_t width, uint32_t height, uint32_t four_cc, texture::Image& image)
+    {
+        if ( four_cc != texture::FOURCC_DXT1 && four_cc != texture::FOURCC_DXT3 && four_cc != texture::FOURCC_DXT5 )
+        {
+            return false;
+        }
+
+        size_t block_size = four_cc == texture::FOURCC_DXT1 ? 8 : 16;
+        uint32_t blocks_x = std::max( 1u, ( width + 3 ) / 4 );
+        uint32_t blocks_y = std::max( 1u, ( height + 3 ) / 4 );
+        if ( width == 0 || height == 0 || size < static_cast<size_t>( blocks_x ) * blocks_y * block_size )
+        {
+            return false;
+        }
+
+        image = texture::Image( width, height );
+        u8 pixels[64];
+        const u8* block = data;
+        for ( uint32_t block_y = 0; block_y < blocks_y; ++block_y )
+        {
+            for ( uint32_t block_x = 0; block_x < blocks_x; ++block_x, block += block_size )
+            {
+                if ( four_cc == texture::FOURCC_DXT1 )
+                {
+                    DecodeColorBlock( block, false, pixels );
+                }
+                else
+                {
+                    DecodeColorBlock( block + 8, true, pixels );
+                    if ( four_cc == texture::FOURCC_DXT5 )
+                    {
+                        DecodeAlphaBlock( block, pixels );
+                    }
+                    else
+                    {
+                        DecodeExplicitAlphaBlock( block, pixels );
+                    }
+                }
+
+                // Edge blocks only partly cover the image
+                uint32_t columns = std::min( 4u, width - block_x * 4 );
+                uint32_t rows = std::min( 4u, height - block_y * 4 );
+                for ( uint32_t y = 0; y < rows; ++y )
+                {
+                    std::memcpy( image.Pixel( block_x * 4, block_y * 4 + y ), pixels + y * 16, columns * 4 );
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Decodes the top mip level of a DDS, block compressed (DXT1/3/5) or uncompressed
+    /// </summary>
+    bool DecodeDDS(const u8* dds, size_t size, texture::Image& image)
+    {
+        const uint32_t DDPF_FOURCC = 0x4;
+
+        binary::BinaryReader<binary::Endian::Little> reader( dds, size );
+        if ( size < texture::DDS_HEADER_SIZE || !reader.MagicAt( 0, "DDS ", 4 ) )
+        {
+            return false;
+        }
+
+        if ( !( reader.Read<uint32_t>( 80 ) & DDPF_FOURCC ) )
+        {
+            return texture::LoadUncompressedDDS( dds, size, image );
+        }
+
+        return DecodeImage( dds + texture::DDS_HEADER_SIZE, size - texture::DDS_HEADER_SIZE, reader.Read<uint32_t>( 16 ), reader.Read<uint32_t>( 12 ), reader.Read<uint32_t>( 84 ), image );
+    }
+}
+
+#endif
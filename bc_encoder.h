@@ -0,0 +1,632 @@
+#ifndef BC_ENCODER_H
+#define BC_ENCODER_H
+
+#include "inc_wrapper.h"
+#include "parallel.h"
+#include "texture.h"
+
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+    #define BC_ENCODER_SSE2 1
+    #include <emmintrin.h>
+#endif
+
+// BC1 (DXT1), BC2 (DXT3) and BC3 (DXT5) block encoder. Endpoints come from the bounding box (fast) or the principal axis of the block's colors,
+// refined by least squares (normal/high). Index selection, which is where most of the time goes, runs 8 pixels at a time with SSE2 where available.
+// Images are split into rows of blocks that are encoded on all cores.
+
+namespace bc
+{
+    enum class Format
+    {
+        BC1,
+        BC2,
+        BC3
+    };
+
+    enum class Quality
+    {
+        Fast,       // bounding box endpoints, one index pass
+        Normal,     // principal axis endpoints + one least squares refinement
+        High        // principal axis and bounding box candidates + several refinements, best one is kept
+    };
+
+    bool GetQualityFromString(const std::string& quality_string, Quality& quality)
+    {
+        if ( quality_string == "fast" ) { quality = Quality::Fast; return true; }
+        if ( quality_string == "normal" ) { quality = Quality::Normal; return true; }
+        if ( quality_string == "high" ) { quality = Quality::High; return true; }
+        return false;
+    }
+
+    size_t BlockSize(Format format)
+    {
+        return format == Format::BC1 ? 8 : 16;
+    }
+
+    const char* ToString(Format format)
+    {
+        switch ( format )
+        {
+            case Format::BC1: return "DXT1";
+            case Format::BC2: return "DXT3";
+            case Format::BC3: return "DXT5";
+            default: return "unknown";
+        }
+    }
+
+    uint32_t FourCC(Format format)
+    {
+        switch ( format )
+        {
+            case Format::BC2: return texture::FOURCC_DXT3;
+            case Format::BC3: return texture::FOURCC_DXT5;
+            default: return texture::FOURCC_DXT1;
+        }
+    }
+
+    /// <summary>
+    /// 4x4 pixels in planar form, so 8 pixels of a channel fit one SSE2 register
+    /// </summary>
+    struct Block
+    {
+        alignas( 16 ) int16_t r[16];
+        alignas( 16 ) int16_t g[16];
+        alignas( 16 ) int16_t b[16];
+        u8 a[16];
+    };
+
+    /// <summary>
+    /// Copies the 4x4 block at (block_x, block_y). Blocks that stick out of the image repeat its last row/column
+    /// </summary>
+    void LoadBlock(const texture::Image& image, uint32_t block_x, uint32_t block_y, Block& block)
+    {
+        for ( uint32_t y = 0; y < 4; ++y )
+        {
+            uint32_t source_y = std::min( block_y * 4 + y, image.height - 1 );
+            for ( uint32_t x = 0; x < 4; ++x )
+            {
+                uint32_t source_x = std::min( block_x * 4 + x, image.width - 1 );
+                const u8* pixel = image.Pixel( source_x, source_y );
+                size_t i = y * 4 + x;
+                block.r[i] = pixel[0];
+                block.g[i] = pixel[1];
+                block.b[i] = pixel[2];
+                block.a[i] = pixel[3];
+            }
+        }
+    }
+
+    uint16_t To565(float r, float g, float b)
+    {
+        auto quantize = [](float value, int max_value)
+        {
+            int quantized = static_cast<int>( std::lround( value * max_value / 255.0f ) );
+            return std::min( std::max( quantized, 0 ), max_value );
+        };
+
+        return static_cast<uint16_t>( ( quantize( r, 31 ) << 11 ) | ( quantize( g, 63 ) << 5 ) | quantize( b, 31 ) );
+    }
+
+    void From565(uint16_t color, int rgb[3])
+    {
+        int r = ( color >> 11 ) & 31;
+        int g = ( color >> 5 ) & 63;
+        int b = color & 31;
+        rgb[0] = ( r << 3 ) | ( r >> 2 );
+        rgb[1] = ( g << 2 ) | ( g >> 4 );
+        rgb[2] = ( b << 3 ) | ( b >> 2 );
+    }
+
+    /// <summary>
+    /// The colors a decoder derives from two endpoints. c0 > c1 gives four colors, otherwise three and transparent black
+    /// </summary>
+    void BuildPalette(uint16_t c0, uint16_t c1, int palette[4][3])
+    {
+        From565( c0, palette[0] );
+        From565( c1, palette[1] );
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            if ( c0 > c1 )
+            {
+                palette[2][channel] = ( 2 * palette[0][channel] + palette[1][channel] ) / 3;
+                palette[3][channel] = ( palette[0][channel] + 2 * palette[1][channel] ) / 3;
+            }
+            else
+            {
+                palette[2][channel] = ( palette[0][channel] + palette[1][channel] ) / 2;
+                palette[3][channel] = 0;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Picks the nearest of the first palette_size colors for every pixel and returns the total squared error
+    /// </summary>
+    uint32_t SelectIndices(const Block& block, const int palette[4][3], int palette_size, u8 indices[16])
+    {
+#if defined(BC_ENCODER_SSE2)
+        uint32_t total_error = 0;
+        const __m128i zero = _mm_setzero_si128();
+
+        for ( int group = 0; group < 2; ++group )
+        {
+            __m128i r = _mm_load_si128( reinterpret_cast<const __m128i*>( block.r + group * 8 ) );
+            __m128i g = _mm_load_si128( reinterpret_cast<const __m128i*>( block.g + group * 8 ) );
+            __m128i b = _mm_load_si128( reinterpret_cast<const __m128i*>( block.b + group * 8 ) );
+
+            __m128i best_low = _mm_set1_epi32( 0x7FFFFFFF );
+            __m128i best_high = best_low;
+            __m128i index_low = zero;
+            __m128i index_high = zero;
+
+            for ( int p = 0; p < palette_size; ++p )
+            {
+                __m128i dr = _mm_sub_epi16( r, _mm_set1_epi16( static_cast<short>( palette[p][0] ) ) );
+                __m128i dg = _mm_sub_epi16( g, _mm_set1_epi16( static_cast<short>( palette[p][1] ) ) );
+                __m128i db = _mm_sub_epi16( b, _mm_set1_epi16( static_cast<short>( palette[p][2] ) ) );
+
+                // madd of (dr, dg) pairs with themselves gives dr^2 + dg^2 per pixel as 32-bit lanes
+                __m128i rg_low = _mm_unpacklo_epi16( dr, dg );
+                __m128i rg_high = _mm_unpackhi_epi16( dr, dg );
+                __m128i b_low = _mm_unpacklo_epi16( db, zero );
+                __m128i b_high = _mm_unpackhi_epi16( db, zero );
+                __m128i error_low = _mm_add_epi32( _mm_madd_epi16( rg_low, rg_low ), _mm_madd_epi16( b_low, b_low ) );
+                __m128i error_high = _mm_add_epi32( _mm_madd_epi16( rg_high, rg_high ), _mm_madd_epi16( b_high, b_high ) );
+
+                __m128i better_low = _mm_cmplt_epi32( error_low, best_low );
+                __m128i better_high = _mm_cmplt_epi32( error_high, best_high );
+                __m128i index = _mm_set1_epi32( p );
+
+                best_low = _mm_or_si128( _mm_and_si128( better_low, error_low ), _mm_andnot_si128( better_low, best_low ) );
+                best_high = _mm_or_si128( _mm_and_si128( better_high, error_high ), _mm_andnot_si128( better_high, best_high ) );
+                index_low = _mm_or_si128( _mm_and_si128( better_low, index ), _mm_andnot_si128( better_low, index_low ) );
+                index_high = _mm_or_si128( _mm_and_si128( better_high, index ), _mm_andnot_si128( better_high, index_high ) );
+            }
+
+            alignas( 16 ) int32_t errors[8];
+            alignas( 16 ) int32_t best_indices[8];
+            _mm_store_si128( reinterpret_cast<__m128i*>( errors ), best_low );
+            _mm_store_si128( reinterpret_cast<__m128i*>( errors + 4 ), best_high );
+            _mm_store_si128( reinterpret_cast<__m128i*>( best_indices ), index_low );
+            _mm_store_si128( reinterpret_cast<__m128i*>( best_indices + 4 ), index_high );
+
+            for ( int i = 0; i < 8; ++i )
+            {
+                indices[group * 8 + i] = static_cast<u8>( best_indices[i] );
+                total_error += static_cast<uint32_t>( errors[i] );
+            }
+        }
+
+        return total_error;
+#else
+        uint32_t total_error = 0;
+        for ( int i = 0; i < 16; ++i )
+        {
+            uint32_t best_error = UINT32_MAX;
+            for ( int p = 0; p < palette_size; ++p )
+            {
+                int dr = block.r[i] - palette[p][0];
+                int dg = block.g[i] - palette[p][1];
+                int db = block.b[i] - palette[p][2];
+                uint32_t error = static_cast<uint32_t>( dr * dr + dg * dg + db * db );
+                if ( error < best_error )
+                {
+                    best_error = error;
+                    indices[i] = static_cast<u8>( p );
+                }
+            }
+            total_error += best_error;
+        }
+        return total_error;
+#endif
+    }
+
+    /// <summary>
+    /// Result of trying a pair of endpoints on a block
+    /// </summary>
+    struct ColorBlock
+    {
+        uint16_t c0 = 0;
+        uint16_t c1 = 0;
+        u8 indices[16] = {};
+        uint32_t error = UINT32_MAX;
+    };
+
+    /// <summary>
+    /// Quantizes two endpoints, orders them for the wanted mode (four colors, or three + transparent for BC1 blocks with transparent pixels) and selects indices
+    /// </summary>
+    ColorBlock TryEndpoints(const Block& block, const float end0[3], const float end1[3], const bool transparent[16], bool three_color)
+    {
+        ColorBlock result;
+        uint16_t c0 = To565( end0[0], end0[1], end0[2] );
+        uint16_t c1 = To565( end1[0], end1[1], end1[2] );
+
+        if ( three_color ? c0 > c1 : c0 < c1 )
+        {
+            std::swap( c0, c1 );
+        }
+
+        int palette[4][3];
+        BuildPalette( c0, c1, palette );
+
+        result.c0 = c0;
+        result.c1 = c1;
+        if ( !three_color && c0 == c1 )
+        {
+            // Both endpoints are the same color, index 0 is right for every pixel in either mode
+            result.error = SelectIndices( block, palette, 1, result.indices );
+            return result;
+        }
+
+        result.error = SelectIndices( block, palette, three_color ? 3 : 4, result.indices );
+        if ( three_color )
+        {
+            for ( int i = 0; i < 16; ++i )
+            {
+                if ( transparent[i] )
+                {
+                    int dr = block.r[i] - palette[result.indices[i]][0];
+                    int dg = block.g[i] - palette[result.indices[i]][1];
+                    int db = block.b[i] - palette[result.indices[i]][2];
+                    result.error -= static_cast<uint32_t>( dr * dr + dg * dg + db * db );
+                    result.indices[i] = 3;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    /// <summary>
+    /// Bounding box of the (opaque) colors, inset a little so the endpoints aren't wasted on outliers
+    /// </summary>
+    void BoundingBoxEndpoints(const Block& block, const bool transparent[16], float end0[3], float end1[3])
+    {
+        const int16_t* channels[3] = { block.r, block.g, block.b };
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            int low = 255;
+            int high = 0;
+            for ( int i = 0; i < 16; ++i )
+            {
+                if ( !transparent[i] )
+                {
+                    low = std::min<int>( low, channels[channel][i] );
+                    high = std::max<int>( high, channels[channel][i] );
+                }
+            }
+
+            float inset = ( high - low ) / 16.0f;
+            end0[channel] = std::max( high - inset, static_cast<float>( low ) );
+            end1[channel] = std::min( low + inset, static_cast<float>( high ) );
+        }
+    }
+
+    /// <summary>
+    /// Endpoints at the extremes of the colors projected on their principal axis (power iteration on the covariance matrix)
+    /// </summary>
+    void PrincipalAxisEndpoints(const Block& block, const bool transparent[16], float end0[3], float end1[3])
+    {
+        float mean[3] = {};
+        int count = 0;
+        for ( int i = 0; i < 16; ++i )
+        {
+            if ( !transparent[i] )
+            {
+                mean[0] += block.r[i];
+                mean[1] += block.g[i];
+                mean[2] += block.b[i];
+                ++count;
+            }
+        }
+        for ( float& value : mean )
+        {
+            value /= std::max( count, 1 );
+        }
+
+        float covariance[6] = {};    // rr, rg, rb, gg, gb, bb
+        for ( int i = 0; i < 16; ++i )
+        {
+            if ( transparent[i] )
+            {
+                continue;
+            }
+
+            float r = block.r[i] - mean[0];
+            float g = block.g[i] - mean[1];
+            float b = block.b[i] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for ( int iteration = 0; iteration < 8; ++iteration )
+        {
+            float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            float length = std::max( std::fabs( x ), std::max( std::fabs( y ), std::fabs( z ) ) );
+            if ( length < 1e-6f )
+            {
+                break;
+            }
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+
+        float axis_length_squared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float low = 0.0f;
+        float high = 0.0f;
+        for ( int i = 0; i < 16; ++i )
+        {
+            if ( transparent[i] )
+            {
+                continue;
+            }
+
+            float t = ( ( block.r[i] - mean[0] ) * axis[0] + ( block.g[i] - mean[1] ) * axis[1] + ( block.b[i] - mean[2] ) * axis[2] ) / axis_length_squared;
+            low = std::min( low, t );
+            high = std::max( high, t );
+        }
+
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            end0[channel] = std::min( std::max( mean[channel] + axis[channel] * high, 0.0f ), 255.0f );
+            end1[channel] = std::min( std::max( mean[channel] + axis[channel] * low, 0.0f ), 255.0f );
+        }
+    }
+
+    /// <summary>
+    /// Least squares endpoints for the current indices: every pixel is a fixed mix of the two endpoints, solve for the pair that fits best
+    /// </summary>
+    bool RefineEndpoints(const Block& block, const ColorBlock& current, const bool transparent[16], bool three_color, float end0[3], float end1[3])
+    {
+        const float FOUR_COLOR_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        const float THREE_COLOR_WEIGHTS[4] = { 1.0f, 0.0f, 0.5f, 0.0f };
+        const float* weights = three_color ? THREE_COLOR_WEIGHTS : FOUR_COLOR_WEIGHTS;
+
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = {}, bx[3] = {};
+        for ( int i = 0; i < 16; ++i )
+        {
+            if ( transparent[i] || ( three_color && current.indices[i] == 3 ) )
+            {
+                continue;
+            }
+
+            float alpha = weights[current.indices[i]];
+            float beta = 1.0f - alpha;
+            float pixel[3] = { static_cast<float>( block.r[i] ), static_cast<float>( block.g[i] ), static_cast<float>( block.b[i] ) };
+
+            aa += alpha * alpha;
+            ab += alpha * beta;
+            bb += beta * beta;
+            for ( int channel = 0; channel < 3; ++channel )
+            {
+                ax[channel] += alpha * pixel[channel];
+                bx[channel] += beta * pixel[channel];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if ( std::fabs( determinant ) < 1e-6f )
+        {
+            return false;
+        }
+
+        for ( int channel = 0; channel < 3; ++channel )
+        {
+            end0[channel] = std::min( std::max( ( bb * ax[channel] - ab * bx[channel] ) / determinant, 0.0f ), 255.0f );
+            end1[channel] = std::min( std::max( ( aa * bx[channel] - ab * ax[channel] ) / determinant, 0.0f ), 255.0f );
+        }
+        return true;
+    }
+
+    /// <summary>
+    /// Encodes the color part of a block. With allow_transparency (BC1), pixels with alpha below 128 become transparent through the three color mode
+    /// </summary>
+    void EncodeColorBlock(const Block& block, Quality quality, bool allow_transparency, u8 output[8])
+    {
+        bool transparent[16];
+        int transparent_count = 0;
+        for ( int i = 0; i < 16; ++i )
+        {
+            transparent[i] = allow_transparency && block.a[i] < 128;
+            transparent_count += transparent[i] ? 1 : 0;
+        }
+
+        ColorBlock best;
+        bool three_color = transparent_count > 0;
+        if ( transparent_count == 16 )
+        {
+            std::fill( best.indices, best.indices + 16, static_cast<u8>( 3 ) );
+        }
+        else
+        {
+            float end0[3];
+            float end1[3];
+
+            if ( quality == Quality::Fast )
+            {
+                BoundingBoxEndpoints( block, transparent, end0, end1 );
+                best = TryEndpoints( block, end0, end1, transparent, three_color );
+            }
+            else
+            {
+                PrincipalAxisEndpoints( block, transparent, end0, end1 );
+                best = TryEndpoints( block, end0, end1, transparent, three_color );
+
+                if ( quality == Quality::High )
+                {
+                    BoundingBoxEndpoints( block, transparent, end0, end1 );
+                    ColorBlock candidate = TryEndpoints( block, end0, end1, transparent, three_color );
+                    if ( candidate.error < best.error )
+                    {
+                        best = candidate;
+                    }
+                }
+
+                int iterations = quality == Quality::High ? 4 : 1;
+                for ( int iteration = 0; iteration < iterations && best.error > 0; ++iteration )
+                {
+                    if ( !RefineEndpoints( block, best, transparent, three_color, end0, end1 ) )
+                    {
+                        break;
+                    }
+
+                    ColorBlock candidate = TryEndpoints( block, end0, end1, transparent, three_color );
+                    if ( candidate.error >= best.error )
+                    {
+                        break;
+                    }
+                    best = candidate;
+                }
+            }
+        }
+
+        uint32_t packed_indices = 0;
+        for ( int i = 0; i < 16; ++i )
+        {
+            packed_indices |= static_cast<uint32_t>( best.indices[i] & 3 ) << ( i * 2 );
+        }
+
+        output[0] = static_cast<u8>( best.c0 );
+        output[1] = static_cast<u8>( best.c0 >> 8 );
+        output[2] = static_cast<u8>( best.c1 );
+        output[3] = static_cast<u8>( best.c1 >> 8 );
+        for ( int i = 0; i < 4; ++i )
+        {
+            output[4 + i] = static_cast<u8>( packed_indices >> ( i * 8 ) );
+        }
+    }
+
+    /// <summary>
+    /// BC3 alpha block: the two extremes as endpoints with six interpolated values between them
+    /// </summary>
+    void EncodeAlphaBlock(const Block& block, u8 output[8])
+    {
+        u8 a0 = *std::max_element( block.a, block.a + 16 );
+        u8 a1 = *std::min_element( block.a, block.a + 16 );
+
+        int palette[8] = { a0, a1 };
+        for ( int i = 1; i < 7; ++i )
+        {
+            palette[i + 1] = ( ( 7 - i ) * a0 + i * a1 ) / 7;
+        }
+
+        uint64_t packed_indices = 0;
+        for ( int i = 0; i < 16 && a0 != a1; ++i )
+        {
+            int best_index = 0;
+            int best_error = 256;
+            for ( int p = 0; p < 8; ++p )
+            {
+                int error = std::abs( block.a[i] - palette[p] );
+                if ( error < best_error )
+                {
+                    best_error = error;
+                    best_index = p;
+                }
+            }
+            packed_indices |= static_cast<uint64_t>( best_index ) << ( i * 3 );
+        }
+
+        output[0] = a0;
+        output[1] = a1;
+        for ( int i = 0; i < 6; ++i )
+        {
+            output[2 + i] = static_cast<u8>( packed_indices >> ( i * 8 ) );
+        }
+    }
+
+    /// <summary>
+    /// BC2 alpha block: 4 bits per pixel, rounded to the nearest of the 16 levels
+    /// </summary>
+    void EncodeExplicitAlphaBlock(const Block& block, u8 output[8])
+    {
+        std::fill( output, output + 8, static_cast<u8>( 0 ) );
+        for ( int i = 0; i < 16; ++i )
+        {
+            int alpha = ( block.a[i] * 15 + 127 ) / 255;
+            output[i / 2] |= static_cast<u8>( alpha << ( ( i & 1 ) * 4 ) );
+        }
+    }
+
+    /// <summary>
+    /// Compresses one mip level. Rows of blocks are handed out to all cores
+    /// </summary>
+    std::vector<u8> CompressImage(const texture::Image& image, Format format, Quality quality)
+    {
+        uint32_t blocks_x = std::max( 1u, ( image.width + 3 ) / 4 );
+        uint32_t blocks_y = std::max( 1u, ( image.height + 3 ) / 4 );
+        size_t block_size = BlockSize( format );
+
+        std::vector<u8> output( static_cast<size_t>( blocks_x ) * blocks_y * block_size );
+
+        std::vector<uint32_t> rows( blocks_y );
+        for ( uint32_t y = 0; y < blocks_y; ++y )
+        {
+            rows[y] = y;
+        }
+
+        parallel::ForEach( rows, [&](uint32_t block_y)
+        {
+            Block block;
+            for ( uint32_t block_x = 0; block_x < blocks_x; ++block_x )
+            {
+                LoadBlock( image, block_x, block_y, block );
+                u8* destination = output.data() + ( static_cast<size_t>( block_y ) * blocks_x + block_x ) * block_size;
+                if ( format == Format::BC1 )
+                {
+                    EncodeColorBlock( block, quality, true, destination );
+                }
+                else
+                {
+                    if ( format == Format::BC2 )
+                    {
+                        EncodeExplicitAlphaBlock( block, destination );
+                    }
+                    else
+                    {
+                        EncodeAlphaBlock( block, destination );
+                    }
+                    EncodeColorBlock( block, quality, false, destination + 8 );
+                }
+            }
+        } );
+
+        return output;
+    }
+
+    /// <summary>
+    /// Full DDS (header + mip_count levels, each a box-filtered half of the previous one) from an RGBA image
+    /// </summary>
+    std::vector<u8> CompressToDDS(const texture::Image& image, uint32_t mip_count, Format format, Quality quality)
+    {
+        mip_count = std::max( mip_count, 1u );
+        std::vector<u8> dds = texture::BuildCompressedDDSHeader( image.width, image.height, mip_count, FourCC( format ) );
+
+        texture::Image level = image;
+        for ( uint32_t mip = 0; mip < mip_count; ++mip )
+        {
+            if ( mip > 0 )
+            {
+                level = texture::Downsample( level );
+            }
+
+            std::vector<u8> blocks = CompressImage( level, format, quality );
+            dds.insert( dds.end(), blocks.begin(), blocks.end() );
+        }
+
+        return dds;
+    }
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef BINARY_READER_H
+#define BINARY_READER_H
+
+#include "inc_wrapper.h"
+
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+// Endian-aware field decoding. The byte order is a template parameter, so the code that reads a header or
+// hashes texture words is instantiated once per endianness instead of checking a bigEndian flag on every read.
+// Loads go through memcpy, so unaligned offsets are fine and nothing is type-punned.
+
+namespace binary
+{
+    enum class Endian
+    {
+        Little,
+        Big
+    };
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    constexpr Endian NativeEndian = Endian::Big;
+#else
+    constexpr Endian NativeEndian = Endian::Little;
+#endif
+
+    inline uint8_t ByteSwap(uint8_t value)
+    {
+        return value;
+    }
+
+    inline uint16_t ByteSwap(uint16_t value)
+    {
+#ifdef _MSC_VER
+        return _byteswap_ushort(value);
+#else
+        return __builtin_bswap16(value);
+#endif
+    }
+
+    inline uint32_t ByteSwap(uint32_t value)
+    {
+#ifdef _MSC_VER
+        return _byteswap_ulong(value);
+#else
+        return __builtin_bswap32(value);
+#endif
+    }
+
+    inline uint64_t ByteSwap(uint64_t value)
+    {
+#ifdef _MSC_VER
+        return _byteswap_uint64(value);
+#else
+        return __builtin_bswap64(value);
+#endif
+    }
+
+    /// <summary>
+    /// Loads a T stored in the given byte order from an arbitrary (possibly unaligned) address
+    /// </summary>
+    template <typename T, Endian E>
+    inline T load(const u8* p)
+    {
+        static_assert(std::is_integral<T>::value, "load only supports integer types");
+        using U = typename std::make_unsigned<T>::type;
+
+        U value;
+        std::memcpy(&value, p, sizeof(U));
+        if constexpr (E != NativeEndian)
+        {
+            value = ByteSwap(value);
+        }
+        return static_cast<T>(value);
+    }
+
+    /// <summary>
+    /// Bounds-checked view over a buffer with a fixed byte order. Reads past the end return zero, which is what the hasher expects for truncated files.
+    /// </summary>
+    template <Endian E>
+    class BinaryReader
+    {
+    public:
+        BinaryReader(const u8* data, size_t size)
+            : data(data), size(size)
+        {
+        }
+
+        const u8* Data() const { return data; }
+        size_t Size() const { return size; }
+
+        bool Has(size_t offset, size_t count) const
+        {
+            return offset <= size && count <= size - offset;
+        }
+
+        template <typename T>
+        T Read(size_t offset) const
+        {
+            if (Has(offset, sizeof(T)))
+            {
+                return load<T, E>(data + offset);
+            }
+
+            // Partially out of range: pad with zeroes like a short read would
+            u8 bytes[sizeof(T)] = {};
+            if (offset < size)
+            {
+                std::memcpy(bytes, data + offset, size - offset);
+            }
+            return load<T, E>(bytes);
+        }
+
+        /// <summary>
+        /// Reads a value with a byte order that doesn't depend on the rest of the format (e.g. K7TX sizes are always little endian)
+        /// </summary>
+        template <typename T, Endian FieldEndian>
+        T ReadAs(size_t offset) const
+        {
+            return BinaryReader<FieldEndian>(data, size).template Read<T>(offset);
+        }
+
+        bool MagicAt(size_t offset, const char* magic, size_t length) const
+        {
+            return Has(offset, length) && std::memcmp(data + offset, magic, length) == 0;
+        }
+
+    private:
+        const u8* data;
+        size_t size;
+    };
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "inc_wrapper.h"
+#include "journal.h"
+
+#include <map>
+#include <set>
+#include <unordered_map>
+
+// Per-texture fingerprints of a whole tree of archives, for --diff between two game builds.
+// A catalog is cached as ddsextractor.catalog in the root of the tree; archives whose size and write time still match aren't read again.
+//
+// File layout (text, tab separated):
+//   DDSEXTRACTOR_CATALOG <version>
+//   A  size  write_time  archive path (relative to the root)
+//   T  member  offset  size  width  height  mipmaps  format  XXH64  replacement name
+// Every A line is followed by the T lines of the textures in that archive (none if it has none). member is the RSL member index path, empty for plain archives.
+
+namespace catalog
+{
+    const char CATALOG_MAGIC[] = "DDSEXTRACTOR_CATALOG";
+    const int CATALOG_VERSION = 1;
+    const char CATALOG_FILE_NAME[] = "ddsextractor.catalog";
+
+    /// <summary>
+    /// Fingerprint of one texture
+    /// </summary>
+    struct Texture
+    {
+        std::string member;         // RSL member ("002_001"), empty for a plain archive
+        uint64_t offset = 0;        // of the DDS data, from the start of the archive
+        uint64_t size = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipmap_count = 0;
+        std::string format;         // four_cc, or "uncompressed"
+        uint64_t hash = 0;          // XXH64 of the DDS data
+        std::string name;           // Replacement name given by --extracthashed, empty if the dimensions are unknown
+    };
+
+    struct Archive
+    {
+        journal::FileStamp stamp;
+        std::vector<Texture> textures;
+    };
+
+    struct Catalog
+    {
+        std::map<std::string, Archive> archives;    // by path relative to the root, '/' separated
+
+        /// <summary>
+        /// The cached entry of an archive, if the archive hasn't changed since it was cataloged
+        /// </summary>
+        const Archive* Find(const std::string& relative_path, const journal::FileStamp& stamp) const
+        {
+            auto it = archives.find( relative_path );
+            if ( !stamp.valid || it == archives.end() || it->second.stamp.size != stamp.size || it->second.stamp.write_time != stamp.write_time )
+            {
+                return nullptr;
+            }
+            return &it->second;
+        }
+    };
+
+    std::string RelativePath(const fs::path& root, const fs::path& file_path)
+    {
+        std::error_code error;
+        fs::path relative_path = fs::relative( file_path, root, error );
+        return ( error || relative_path.empty() ? file_path : relative_path ).generic_u8string();
+    }
+
+    /// <summary>
+    /// Where a texture is, e.g. "data/st00.rsl:002_001", used to match textures between two catalogs
+    /// </summary>
+    std::string Location(const std::string& archive_path, const Texture& texture)
+    {
+        return texture.member.empty() ? archive_path : archive_path + ":" + texture.member;
+    }
+
+    std::vector<std::string> SplitFields(const std::string& line)
+    {
+        std::vector<std::string> fields;
+        std::stringstream stream( line );
+        std::string field;
+        while ( std::getline( stream, field, '\t' ) )
+        {
+            fields.push_back( field );
+        }
+        if ( !line.empty() && line.back() == '\t' )
+        {
+            fields.emplace_back();
+        }
+        return fields;
+    }
+
+    /// <summary>
+    /// Loads a cached catalog. A missing, outdated or damaged file gives an empty catalog (or the archives before the damage), which only means more archives are read
+    /// </summary>
+    bool Load(const fs::path& catalog_path, Catalog& catalog)
+    {
+        std::ifstream file( catalog_path, std::ios::binary );
+        std::string line;
+        if ( !std::getline( file, line ) || line != std::string( CATALOG_MAGIC ) + " " + std::to_string( CATALOG_VERSION ) )
+        {
+            return false;
+        }
+
+        Archive* archive = nullptr;
+        while ( std::getline( file, line ) )
+        {
+            std::vector<std::string> fields = SplitFields( line );
+            try
+            {
+                if ( fields.size() == 4 && fields[0] == "A" )
+                {
+                    archive = &catalog.archives[fields[3]];
+                    archive->stamp.valid = true;
+                    archive->stamp.size = std::stoull( fields[1] );
+                    archive->stamp.write_time = std::stoll( fields[2] );
+                    archive->textures.clear();
+                }
+                else if ( fields.size() == 10 && fields[0] == "T" && archive != nullptr )
+                {
+                    Texture texture;
+                    texture.member = fields[1];
+                    texture.offset = std::stoull( fields[2] );
+                    texture.size = std::stoull( fields[3] );
+                    texture.width = static_cast<uint32_t>( std::stoul( fields[4] ) );
+                    texture.height = static_cast<uint32_t>( std::stoul( fields[5] ) );
+                    texture.mipmap_count = static_cast<uint32_t>( std::stoul( fields[6] ) );
+                    texture.format = fields[7];
+                    texture.hash = std::stoull( fields[8], nullptr, 16 );
+                    texture.name = fields[9];
+                    archive->textures.push_back( texture );
+                }
+                else
+                {
+                    break;
+                }
+            }
+            catch ( const std::exception& )
+            {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    bool Save(const fs::path& catalog_path, const Catalog& catalog)
+    {
+        std::ostringstream text;
+        text << CATALOG_MAGIC << " " << CATALOG_VERSION << "\n";
+        for ( const auto& archive : catalog.archives )
+        {
+            text << "A\t" << archive.second.stamp.size << "\t" << archive.second.stamp.write_time << "\t" << archive.first << "\n";
+            for ( const Texture& texture : archive.second.textures )
+            {
+                text << "T\t" << texture.member << "\t" << texture.offset << "\t" << texture.size << "\t" << texture.width << "\t" << texture.height << "\t"
+                     << texture.mipmap_count << "\t" << texture.format << "\t" << std::hex << texture.hash << std::dec << "\t" << texture.name << "\n";
+            }
+        }
+
+        std::string contents = text.str();
+        return journal::WriteFileDurably( catalog_path, reinterpret_cast<const u8*>( contents.data() ), contents.size() );
+    }
+
+    /// <summary>
+    /// One difference between two catalogs. Moved means the same contents at another place (another archive/member, or another offset in the same one)
+    /// </summary>
+    struct Change
+    {
+        enum class Kind
+        {
+            ADDED,
+            REMOVED,
+            MOVED,
+            CHANGED
+        };
+
+        Kind kind;
+        std::string old_location;       // empty for ADDED
+        std::string new_location;       // empty for REMOVED
+        const Texture* old_texture = nullptr;
+        const Texture* new_texture = nullptr;
+    };
+
+    const char* ToString(Change::Kind kind)
+    {
+        switch ( kind )
+        {
+            case Change::Kind::ADDED: return "added";
+            case Change::Kind::REMOVED: return "removed";
+            case Change::Kind::MOVED: return "moved";
+            case Change::Kind::CHANGED: return "changed";
+            default: return "unknown";
+        }
+    }
+
+    /// <summary>
+    /// Compares two catalogs texture by texture. Textures are matched by location first; whatever is left on one side is matched by content hash
+    /// to find the ones that moved. The changes are sorted by location, unchanged textures are only counted
+    /// </summary>
+    std::vector<Change> Diff(const Catalog& old_catalog, const Catalog& new_catalog, size_t& unchanged)
+    {
+        auto by_location = [](const Catalog& catalog)
+        {
+            std::map<std::string, const Texture*> textures;
+            for ( const auto& archive : catalog.archives )
+            {
+                for ( const Texture& texture : archive.second.textures )
+                {
+                    textures[Location( archive.first, texture )] = &texture;
+                }
+            }
+            return textures;
+        };
+
+        std::map<std::string, const Texture*> old_textures = by_location( old_catalog );
+        std::map<std::string, const Texture*> new_textures = by_location( new_catalog );
+
+        std::vector<Change> changes;
+        unchanged = 0;
+
+        // Textures that are only in the new tree, by content, so removed textures can be matched with where they went
+        std::unordered_multimap<uint64_t, std::string> added_by_hash;
+        for ( const auto& entry : new_textures )
+        {
+            if ( old_textures.find( entry.first ) == old_textures.end() )
+            {
+                added_by_hash.emplace( entry.second->hash, entry.first );
+            }
+        }
+
+        std::set<std::string> moved_to;
+        for ( const auto& entry : old_textures )
+        {
+            auto it = new_textures.find( entry.first );
+            if ( it != new_textures.end() )
+            {
+                if ( it->second->hash != entry.second->hash || it->second->size != entry.second->size )
+                {
+                    changes.push_back( Change{ Change::Kind::CHANGED, entry.first, it->first, entry.second, it->second } );
+                }
+                else if ( it->second->offset != entry.second->offset )
+                {
+                    changes.push_back( Change{ Change::Kind::MOVED, entry.first, it->first, entry.second, it->second } );
+                }
+                else
+                {
+                    ++unchanged;
+                }
+                continue;
+            }
+
+            auto match = added_by_hash.find( entry.second->hash );
+            if ( match != added_by_hash.end() )
+            {
+                const Texture* new_texture = new_textures[match->second];
+                changes.push_back( Change{ Change::Kind::MOVED, entry.first, match->second, entry.second, new_texture } );
+                moved_to.insert( match->second );
+                added_by_hash.erase( match );
+            }
+            else
+            {
+                changes.push_back( Change{ Change::Kind::REMOVED, entry.first, std::string(), entry.second, nullptr } );
+            }
+        }
+
+        for ( const auto& entry : new_textures )
+        {
+            if ( old_textures.find( entry.first ) == old_textures.end() && moved_to.find( entry.first ) == moved_to.end() )
+            {
+                changes.push_back( Change{ Change::Kind::ADDED, std::string(), entry.first, nullptr, entry.second } );
+            }
+        }
+
+        std::sort( changes.begin(), changes.end(), [](const Change& a, const Change& b)
+        {
+            const std::string& a_location = a.old_location.empty() ? a.new_location : a.old_location;
+            const std::string& b_location = b.old_location.empty() ? b.new_location : b.old_location;
+            return a_location < b_location;
+        } );
+
+        return changes;
+    }
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "inc_wrapper.h"
+
+// XXH64 from the xxHash family, used for fast whole-buffer comparisons (round-trip checks, patches, catalogs).
+// Reference: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+
+namespace checksum
+{
+    const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+    const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+    uint64_t rotateLeft64(uint64_t value, int count)
+    {
+        return (value << count) | (value >> (64 - count));
+    }
+
+    uint64_t read64(const u8* p)
+    {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t read32(const u8* p)
+    {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint64_t round64(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME64_2;
+        acc = rotateLeft64(acc, 31);
+        return acc * PRIME64_1;
+    }
+
+    uint64_t mergeRound64(uint64_t acc, uint64_t value)
+    {
+        acc ^= round64(0, value);
+        return acc * PRIME64_1 + PRIME64_4;
+    }
+
+    /// <summary>
+    /// XXH64 of a buffer. Assumes a little-endian host, like the rest of the tool.
+    /// </summary>
+    uint64_t XXH64(const void* input, size_t length, uint64_t seed = 0)
+    {
+        const u8* p = static_cast<const u8*>(input);
+        const u8* end = p + length;
+        uint64_t hash;
+
+        if (length >= 32)
+        {
+            uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+            uint64_t v2 = seed + PRIME64_2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - PRIME64_1;
+
+            const u8* limit = end - 32;
+            do
+            {
+                v1 = round64(v1, read64(p)); p += 8;
+                v2 = round64(v2, read64(p)); p += 8;
+                v3 = round64(v3, read64(p)); p += 8;
+                v4 = round64(v4, read64(p)); p += 8;
+            } while (p <= limit);
+
+            hash = rotateLeft64(v1, 1) + rotateLeft64(v2, 7) + rotateLeft64(v3, 12) + rotateLeft64(v4, 18);
+            hash = mergeRound64(hash, v1);
+            hash = mergeRound64(hash, v2);
+            hash = mergeRound64(hash, v3);
+            hash = mergeRound64(hash, v4);
+        }
+        else
+        {
+            hash = seed + PRIME64_5;
+        }
+
+        hash += static_cast<uint64_t>(length);
+
+        while (p + 8 <= end)
+        {
+            hash ^= round64(0, read64(p));
+            hash = rotateLeft64(hash, 27) * PRIME64_1 + PRIME64_4;
+            p += 8;
+        }
+
+        if (p + 4 <= end)
+        {
+            hash ^= static_cast<uint64_t>(read32(p)) * PRIME64_1;
+            hash = rotateLeft64(hash, 23) * PRIME64_2 + PRIME64_3;
+            p += 4;
+        }
+
+        while (p < end)
+        {
+            hash ^= (*p) * PRIME64_5;
+            hash = rotateLeft64(hash, 11) * PRIME64_1;
+            ++p;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME64_2;
+        hash ^= hash >> 29;
+        hash *= PRIME64_3;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+    uint64_t XXH64(const std::vector<u8>& buffer)
+    {
+        return XXH64(buffer.data(), buffer.size());
+    }
+
+    /// <summary>
+    /// Formats a checksum as 16 hex digits
+    /// </summary>
+    std::string ToHex(uint64_t value)
+    {
+        char text[16 + 1];
+        sprintf_s(text, "%016llx", static_cast<unsigned long long>(value));
+        return text;
+    }
+}
+
+#endif
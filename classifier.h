@@ -0,0 +1,128 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include "inc_wrapper.h"
+#include "binary_reader.h"
+
+// Content sniffing: decides what kind of texture container a file is from its first few hundred bytes,
+// so files can be routed by what they contain instead of by their extension.
+
+namespace classifier
+{
+    enum class FileClass
+    {
+        GCT0,           // GCT0 header (big endian) with raw texture data at 0x40
+        GCT0_NULL,      // same header with a null magic (little endian)
+        K7TX,           // GCT0 header followed by a K7TX block with DDS data
+        DDS,            // DDS data embedded somewhere in an archive
+        DDS_FILE,       // a standalone .dds (e.g. output of --extract)
+        JMB,            // JMB texture header
+        STI,            // GCT0 header that isn't at the start of the file
+        RSL,            // RMHG resource archive, its members are classified on their own
+        PATCH,          // .ddspatch written by --import --patch
+        UNKNOWN,
+        COUNT
+    };
+
+    const size_t SNIFF_SIZE = 512;
+
+    const char* ToString(FileClass file_class)
+    {
+        switch (file_class)
+        {
+            case FileClass::GCT0: return "GCT0";
+            case FileClass::GCT0_NULL: return "GCT0 (null magic)";
+            case FileClass::K7TX: return "K7TX";
+            case FileClass::DDS: return "embedded DDS";
+            case FileClass::DDS_FILE: return "DDS file";
+            case FileClass::JMB: return "JMB";
+            case FileClass::STI: return "STI";
+            case FileClass::RSL: return "RSL archive";
+            case FileClass::PATCH: return "patch";
+            default: return "unknown";
+        }
+    }
+
+    bool ContainsAt(const u8* data, size_t size, const char* pattern, size_t length, size_t& found_pos)
+    {
+        const u8* end = data + size;
+        const u8* match = std::search(data, end, pattern, pattern + length);
+        found_pos = static_cast<size_t>(match - data);
+        return match != end;
+    }
+
+    /// <summary>
+    /// Classifies a file from the start of its contents (normally the first SNIFF_SIZE bytes)
+    /// </summary>
+    FileClass ClassifyBuffer(const u8* data, size_t size)
+    {
+        const char GCT0_MAGIC[] = "GCT0";
+        const char DDS_MAGIC[] = "DDS |";
+        const char JMB_MAGIC[] = { 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00 };
+
+        binary::BinaryReader<binary::Endian::Big> big_endian_reader(data, size);
+        binary::BinaryReader<binary::Endian::Little> little_endian_reader(data, size);
+
+        if (big_endian_reader.MagicAt(0, "RMHG", 4))
+        {
+            return FileClass::RSL;
+        }
+
+        if (big_endian_reader.MagicAt(0, "DXPT", 4))
+        {
+            return FileClass::PATCH;
+        }
+
+        // GCT0 header at the start, with the texture data at 0x40 like the hasher expects
+        bool gct0_magic = big_endian_reader.MagicAt(0, GCT0_MAGIC, 4);
+        bool null_magic = little_endian_reader.Has(0, 4) && little_endian_reader.Read<uint32_t>(0) == 0;
+        if (gct0_magic || null_magic)
+        {
+            int32_t texture_start = gct0_magic ? big_endian_reader.Read<int32_t>(0x10) : little_endian_reader.Read<int32_t>(0x10);
+            if (texture_start == 0x40 && size > 0x40)
+            {
+                if (big_endian_reader.MagicAt(0x40, "K7TX", 4))
+                {
+                    return FileClass::K7TX;
+                }
+                return gct0_magic ? FileClass::GCT0 : FileClass::GCT0_NULL;
+            }
+        }
+
+        size_t found_pos;
+        if (ContainsAt(data, size, DDS_MAGIC, 5, found_pos))
+        {
+            return found_pos == 0 ? FileClass::DDS_FILE : FileClass::DDS;
+        }
+
+        if (ContainsAt(data, size, JMB_MAGIC, sizeof(JMB_MAGIC), found_pos))
+        {
+            return FileClass::JMB;
+        }
+
+        if (ContainsAt(data, size, GCT0_MAGIC, 4, found_pos))
+        {
+            return FileClass::STI;
+        }
+
+        return FileClass::UNKNOWN;
+    }
+
+    /// <summary>
+    /// Reads only the first SNIFF_SIZE bytes of the file and classifies them
+    /// </summary>
+    FileClass ClassifyFile(const fs::path& file_path)
+    {
+        std::ifstream file(file_path, std::ios::binary);
+        if (!file)
+        {
+            return FileClass::UNKNOWN;
+        }
+
+        u8 head[SNIFF_SIZE];
+        file.read(reinterpret_cast<char*>(head), sizeof(head));
+        return ClassifyBuffer(head, static_cast<size_t>(file.gcount()));
+    }
+}
+
+#endif
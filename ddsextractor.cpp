@@ -0,0 +1,205 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define DDSEXTRACTOR_BUILD
+
+#include "ddsextractor.h"
+#include "extractorimpl.h"
+
+namespace DDSExtractor
+{
+    namespace Library
+    {
+        ExtractResult ExtractFromBuffer(const uint8_t* data, size_t size)
+        {
+            ExtractResult result;
+
+            if ( !FindPatternInBuffer( data, size, result.offset ) )
+            {
+                result.status = Status::PATTERN_NOT_FOUND;
+                return result;
+            }
+
+            // Same as ExtractDDS: everything from the pattern to the end of the archive
+            result.dds_data.assign( data + result.offset, data + size );
+            return result;
+        }
+
+        ExtractResult ExtractFromFile(const std::filesystem::path& path)
+        {
+            std::vector<u8> buffer;
+            if ( !ReadFileToBuffer( path, buffer ) )
+            {
+                ExtractResult result;
+                result.status = Status::FILE_ERROR;
+                return result;
+            }
+
+            return ExtractFromBuffer( buffer.data(), buffer.size() );
+        }
+
+        /// <summary>
+        /// HashBuffer for data from a file with the given extension (empty if unknown), which decides whether GCT0 headers further in are looked for
+        /// </summary>
+        HashResult HashBufferWithExtension(const uint8_t* data, size_t size, const std::string& extension)
+        {
+            hasher::TextureHash texture_hash = hasher::HashTextureBuffer( data, size );
+
+            HashResult result;
+            result.width = texture_hash.width;
+            result.height = texture_hash.height;
+            result.hash = texture_hash.hash;
+            result.name = texture_hash.name;
+            for ( const hasher::HashCandidate& candidate : hasher::HashVariants( data, size, extension ) )
+            {
+                result.candidates.push_back( candidate.name );
+            }
+            return result;
+        }
+
+        HashResult HashBuffer(const uint8_t* data, size_t size)
+        {
+            return HashBufferWithExtension( data, size, std::string() );
+        }
+
+        HashResult HashFile(const std::filesystem::path& path)
+        {
+            std::vector<u8> buffer;
+            if ( !ReadFileToBuffer( path, buffer ) )
+            {
+                HashResult result;
+                result.status = Status::FILE_ERROR;
+                return result;
+            }
+
+            return HashBufferWithExtension( buffer.data(), buffer.size(), path.extension().string() );
+        }
+
+        ImportResult ImportIntoBuffer(const uint8_t* archive, size_t archive_size, const uint8_t* dds, size_t dds_size)
+        {
+            ImportResult result;
+
+            size_t found_pos;
+            if ( !FindPatternInBuffer( archive, archive_size, found_pos ) )
+            {
+                result.status = Status::PATTERN_NOT_FOUND;
+                return result;
+            }
+
+            result.archive_data = SpliceDDS( archive, archive_size, found_pos, dds, dds_size );
+            return result;
+        }
+
+        Status ImportIntoFile(const std::filesystem::path& archive_path, const std::filesystem::path& dds_path)
+        {
+            std::vector<u8> archive;
+            std::vector<u8> dds;
+            if ( !ReadFileToBuffer( archive_path, archive ) || !ReadFileToBuffer( dds_path, dds ) )
+            {
+                return Status::FILE_ERROR;
+            }
+
+            ImportResult result = ImportIntoBuffer( archive.data(), archive.size(), dds.data(), dds.size() );
+            if ( result.status != Status::OK )
+            {
+                return result.status;
+            }
+
+            // Same as --import: nothing is written if the DDS is already in the archive, and the archive is replaced in one step,
+            // so a crash or a full disk leaves the original intact
+            if ( result.archive_data == archive )
+            {
+                return Status::OK;
+            }
+
+            return SaveImportedArchive( archive_path, archive, result.archive_data, false ) ? Status::OK : Status::FILE_ERROR;
+        }
+
+        ConvertResult ConvertGCT0ToDDS(const uint8_t* data, size_t size)
+        {
+            ConvertResult result;
+
+            try
+            {
+                result.dds_data = GCT0CMPRBufferToDXT1DDS( data, size );
+            }
+            catch ( const std::runtime_error& )
+            {
+                result.status = Status::INVALID_DATA;
+            }
+
+            return result;
+        }
+
+        ConvertResult ConvertGCT0FileToDDS(const std::filesystem::path& path)
+        {
+            std::vector<u8> buffer;
+            if ( !ReadFileToBuffer( path, buffer ) )
+            {
+                ConvertResult result;
+                result.status = Status::FILE_ERROR;
+                return result;
+            }
+
+            return ConvertGCT0ToDDS( buffer.data(), buffer.size() );
+        }
+
+        void ExtractDirectory(const std::filesystem::path& directory, const std::vector<std::string>& extensions, const ExtractCallback& callback)
+        {
+            parallel::WorkQueue<fs::path> queue;
+            std::exception_ptr walk_error;
+            std::thread walk_thread( [&]()
+            {
+                try
+                {
+                    walker::Walk( directory, walker::ExtensionSet( extensions ), [&queue](const fs::path& file_path) { queue.Push( file_path ); } );
+                }
+                catch ( const std::exception& )
+                {
+                    walk_error = std::current_exception();
+                }
+                queue.Close();
+            } );
+
+            // Nothing may be printed from here: the first exception (from the callback, or e.g. out of memory) is kept and rethrown once all files are done
+            std::exception_ptr first_error;
+            std::mutex error_mutex;
+            auto keep_error = [&](const std::exception&)
+            {
+                std::lock_guard<std::mutex> lock( error_mutex );
+                if ( !first_error )
+                {
+                    first_error = std::current_exception();
+                }
+            };
+
+            parallel::Drain( queue, parallel::WorkerCount(), [&callback](const fs::path& file_path)
+            {
+                std::vector<u8> buffer;
+                ExtractResult extract_result;
+                HashResult hash_result;
+
+                if ( !ReadFileToBuffer( file_path, buffer ) )
+                {
+                    extract_result.status = Status::FILE_ERROR;
+                    hash_result.status = Status::FILE_ERROR;
+                }
+                else
+                {
+                    extract_result = ExtractFromBuffer( buffer.data(), buffer.size() );
+                    hash_result = HashBufferWithExtension( buffer.data(), buffer.size(), file_path.extension().string() );
+                }
+
+                callback( file_path, extract_result, hash_result );
+            }, keep_error );
+
+            walk_thread.join();
+            if ( walk_error )
+            {
+                std::rethrow_exception( walk_error );
+            }
+            if ( first_error )
+            {
+                std::rethrow_exception( first_error );
+            }
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef DDSEXTRACTOR_H
+#define DDSEXTRACTOR_H
+
+// Public API of the DDSExtractor library (DDSExtractorLib / DDSExtractorDll projects).
+// This is the only header an embedding application needs: nothing here prints to the console,
+// results come back as return structs or through callbacks.
+// Define DDSEXTRACTOR_SHARED when linking against the DLL.
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+
+#if defined(DDSEXTRACTOR_SHARED)
+    #if defined(_WIN32)
+        #if defined(DDSEXTRACTOR_BUILD)
+            #define DDSEXTRACTOR_API __declspec(dllexport)
+        #else
+            #define DDSEXTRACTOR_API __declspec(dllimport)
+        #endif
+    #else
+        #define DDSEXTRACTOR_API __attribute__((visibility("default")))
+    #endif
+#else
+    #define DDSEXTRACTOR_API
+#endif
+
+namespace DDSExtractor
+{
+    namespace Library
+    {
+        enum class Status
+        {
+            OK,
+            FILE_ERROR,
+            PATTERN_NOT_FOUND,
+            INVALID_DATA
+        };
+
+        struct ExtractResult
+        {
+            Status status = Status::OK;
+            size_t offset = 0;                  // position of the DDS data inside the archive
+            std::vector<uint8_t> dds_data;
+        };
+
+        struct HashResult
+        {
+            Status status = Status::OK;
+            uint16_t width = 0;
+            uint16_t height = 0;
+            uint32_t hash = 0;
+            std::string name;                   // WIDTHxHEIGHT_hash, empty when the texture has no valid GCT0 header
+            std::vector<std::string> candidates;    // every hash variant name the Replacement loader might use, name first if there is one
+        };
+
+        struct ImportResult
+        {
+            Status status = Status::OK;
+            std::vector<uint8_t> archive_data;  // archive with the new DDS data spliced in
+        };
+
+        struct ConvertResult
+        {
+            Status status = Status::OK;
+            std::vector<uint8_t> dds_data;      // DXT1 DDS, empty for GCT0 image types that aren't CMPR
+        };
+
+        /// <summary>
+        /// Finds the DDS data in an archive, same as --extract
+        /// </summary>
+        DDSEXTRACTOR_API ExtractResult ExtractFromBuffer(const uint8_t* data, size_t size);
+        DDSEXTRACTOR_API ExtractResult ExtractFromFile(const std::filesystem::path& path);
+
+        /// <summary>
+        /// Calculates the Replacement texture name, same as --extracthashed
+        /// </summary>
+        DDSEXTRACTOR_API HashResult HashBuffer(const uint8_t* data, size_t size);
+        DDSEXTRACTOR_API HashResult HashFile(const std::filesystem::path& path);
+
+        /// <summary>
+        /// Replaces the DDS data of an archive, same as --import. ImportIntoFile rewrites the archive on disk in one step (it's left alone if nothing changes).
+        /// </summary>
+        DDSEXTRACTOR_API ImportResult ImportIntoBuffer(const uint8_t* archive, size_t archive_size, const uint8_t* dds, size_t dds_size);
+        DDSEXTRACTOR_API Status ImportIntoFile(const std::filesystem::path& archive_path, const std::filesystem::path& dds_path);
+
+        /// <summary>
+        /// Converts a fixed GCT0 CMPR texture into a DXT1 DDS, same as --bintodds
+        /// </summary>
+        DDSEXTRACTOR_API ConvertResult ConvertGCT0ToDDS(const uint8_t* data, size_t size);
+        DDSEXTRACTOR_API ConvertResult ConvertGCT0FileToDDS(const std::filesystem::path& path);
+
+        using ExtractCallback = std::function<void(const std::filesystem::path& path, const ExtractResult& result, const HashResult& hash)>;
+
+        /// <summary>
+        /// Walks a directory and calls the callback once per archive with its DDS data and hash.
+        /// Files are processed in parallel, so the callback can be called from several threads at once.
+        /// If the callback throws, the other files are still processed and the first exception is rethrown at the end.
+        /// Throws std::filesystem::filesystem_error if the directory itself can't be listed.
+        /// Extensions are compared case-insensitively, e.g. { ".bin", ".dat" }
+        /// </summary>
+        DDSEXTRACTOR_API void ExtractDirectory(const std::filesystem::path& directory, const std::vector<std::string>& extensions, const ExtractCallback& callback);
+    }
+}
+
+#endif
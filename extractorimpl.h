@@ -4,6 +4,24 @@
 #include "inc_wrapper.h"
 #include "hasher.h"
 #include "NMH.h"
+#include "parallel.h"
+#include "checksum.h"
+#include "watcher.h"
+#include "walker.h"
+#include "classifier.h"
+#include "mapped_file.h"
+#include "journal.h"
+#include "rsl.h"
+#include "hash_index.h"
+#include "patch.h"
+#include "texture.h"
+#include "bc_encoder.h"
+#include "bc_decoder.h"
+#include "catalog.h"
+#include "staging.h"
+
+#include <memory>
+#include <set>
 
 const std::vector<uint8_t> DDS_MAGIC_PATTERN = { 0x44, 0x44, 0x53, 0x20, 0x7C };
 
@@ -13,14 +31,36 @@ enum class ExtractorMode
     EXTRACT_HASHED,
     EXTRACT_ARCHIVE,
     IMPORT,
+    IMPORT_HASHED,
     METADATA,
     NMH_FIX_AND_HASH,
+    NMH_FIX_AND_HASH_DDS,
     BIG_TO_LITTLE_ENDIAN,
     GM2,
     BIN_TO_DDS,
+    VERIFY,
+    APPLY_PATCH,
+    COMPRESS,
+    PREVIEW,
     NONE
 };
 
+/// <summary>
+/// Options that change how files are picked and processed, independent of the mode
+/// </summary>
+struct ProcessOptions
+{
+    bool sniff = false;     // pick and route files by their first bytes instead of by extension
+    bool resume = false;    // skip (file, mode) combinations that the journal says are already done
+    journal::Journal* journal = nullptr;    // completed work is recorded here when set
+    hash_index::IndexBuilder* index_builder = nullptr;  // --extracthashed adds every texture it names here
+    const hash_index::Index* index = nullptr;           // where --importhashed looks up the source archive of a texture
+    bool patch = false;     // imports write a .ddspatch next to the archive instead of modifying it
+    bc::Quality quality = bc::Quality::Normal;          // --compress encoder quality
+    bool ppm = false;       // --preview writes .ppm instead of .tga
+    texture::ContactSheet* contact_sheet = nullptr;     // --preview adds a thumbnail of every texture here when set
+};
+
 namespace DDSExtractor
 {
     /// <summary>
@@ -31,15 +71,80 @@ namespace DDSExtractor
         if ( mode_string == "--extract" ) return ExtractorMode::EXTRACT;
         if ( mode_string == "--extracthashed" ) return ExtractorMode::EXTRACT_HASHED;
         if ( mode_string == "--import" ) return ExtractorMode::IMPORT;
+        if ( mode_string == "--importhashed" ) return ExtractorMode::IMPORT_HASHED;
         if ( mode_string == "--metadata" ) return ExtractorMode::METADATA;
         if ( mode_string == "--nmhfixandhash" ) return ExtractorMode::NMH_FIX_AND_HASH;
+        if ( mode_string == "--nmhfixandhashdds" ) return ExtractorMode::NMH_FIX_AND_HASH_DDS;
         if ( mode_string == "--btole" ) return ExtractorMode::BIG_TO_LITTLE_ENDIAN;
         if ( mode_string == "--gm2" ) return ExtractorMode::GM2;
         if ( mode_string == "--bintodds" ) return ExtractorMode::BIN_TO_DDS;
+        if ( mode_string == "--verify" ) return ExtractorMode::VERIFY;
+        if ( mode_string == "--applypatch" ) return ExtractorMode::APPLY_PATCH;
+        if ( mode_string == "--compress" ) return ExtractorMode::COMPRESS;
+        if ( mode_string == "--preview" ) return ExtractorMode::PREVIEW;
 
         return ExtractorMode::NONE;
     }
 
+    /// <summary>
+    /// Name of the mode without the leading "--", as used in --mode lists and in the journal
+    /// </summary>
+    std::string GetModeName(ExtractorMode extract_mode)
+    {
+        switch ( extract_mode )
+        {
+            case ExtractorMode::EXTRACT: return "extract";
+            case ExtractorMode::EXTRACT_HASHED: return "extracthashed";
+            case ExtractorMode::EXTRACT_ARCHIVE: return "extractarchive";
+            case ExtractorMode::IMPORT: return "import";
+            case ExtractorMode::IMPORT_HASHED: return "importhashed";
+            case ExtractorMode::METADATA: return "metadata";
+            case ExtractorMode::NMH_FIX_AND_HASH: return "nmhfixandhash";
+            case ExtractorMode::NMH_FIX_AND_HASH_DDS: return "nmhfixandhashdds";
+            case ExtractorMode::BIG_TO_LITTLE_ENDIAN: return "btole";
+            case ExtractorMode::GM2: return "gm2";
+            case ExtractorMode::BIN_TO_DDS: return "bintodds";
+            case ExtractorMode::VERIFY: return "verify";
+            case ExtractorMode::APPLY_PATCH: return "applypatch";
+            case ExtractorMode::COMPRESS: return "compress";
+            case ExtractorMode::PREVIEW: return "preview";
+            default: return "none";
+        }
+    }
+
+    /// <summary>
+    /// Extensions of the archives the tool works on. Matched case-insensitively, so .BIN/.bin etc. don't have to be listed separately
+    /// </summary>
+    walker::ExtensionSet ArchiveExtensions()
+    {
+        return { ".bin", ".dat", ".sti", ".jmb", ".gm2" };
+    }
+
+    /// <summary>
+    /// Archive that a *_extracted file belongs to (st00_extracted.dds -> st00.BIN in the same folder), or an empty path
+    /// </summary>
+    fs::path FindExtractedSource(const fs::path& extracted_path, const walker::ExtensionSet& extensions)
+    {
+        const std::string EXTRACTED_SUFFIX = "_extracted";
+
+        std::string stem = extracted_path.stem().string();
+        if ( stem.size() <= EXTRACTED_SUFFIX.size() || stem.compare( stem.size() - EXTRACTED_SUFFIX.size(), EXTRACTED_SUFFIX.size(), EXTRACTED_SUFFIX ) != 0 )
+        {
+            return {};
+        }
+
+        std::string archive_stem = stem.substr( 0, stem.size() - EXTRACTED_SUFFIX.size() );
+        std::error_code error;
+        for ( fs::directory_iterator it( extracted_path.parent_path(), error ), end; !error && it != end; it.increment( error ) )
+        {
+            if ( it->path().stem() == archive_stem && extensions.Matches( it->path() ) && it->is_regular_file( error ) )
+            {
+                return it->path();
+            }
+        }
+        return {};
+    }
+
     // Helper function to reverse the byte order of data in-place
     void reverseBytes(char* data, std::size_t size)
     {
@@ -195,6 +300,9 @@ namespace DDSExtractor
 
         found_pos = 0;
 
+        // tellg() is -1 once a short final read has set failbit, so the position is counted instead
+        std::streamoff start = file.tellg();
+        std::streamoff consumed = 0;
         while ( file.read( reinterpret_cast<char*>( buffer.data() ), buffer.size() ) || file.gcount() > 0 )
         {
             std::streamsize bytes_read = file.gcount();
@@ -204,17 +312,71 @@ namespace DDSExtractor
                 std::rotate( window.begin(), window.begin() + 1, window.end() );
                 window.back() = buffer[i];
 
-                if ( window == DDS_MAGIC_PATTERN )
+                if ( window == DDS_MAGIC_PATTERN && consumed + i + 1 >= static_cast<std::streamoff>( pattern_length ) )
                 {
-                    found_pos = static_cast<std::streamoff>( file.tellg() ) - bytes_read + i - pattern_length + 1;
+                    found_pos = start + consumed + i - static_cast<std::streamoff>( pattern_length ) + 1;
                     return true;
                 }
             }
+
+            consumed += bytes_read;
         }
 
         return false;
     }
 
+    /// <summary>
+    /// Same as FindPattern, but for data that is already in memory
+    /// </summary>
+    bool FindPatternInBuffer(const u8* data, size_t size, size_t& found_pos)
+    {
+        const u8* end = data + size;
+        const u8* match = std::search( data, end, DDS_MAGIC_PATTERN.begin(), DDS_MAGIC_PATTERN.end() );
+
+        found_pos = 0;
+        if ( match == end )
+        {
+            return false;
+        }
+
+        found_pos = static_cast<size_t>( match - data );
+        return true;
+    }
+
+    /// <summary>
+    /// Reads a whole file into a buffer
+    /// </summary>
+    bool ReadFileToBuffer(const fs::path& file_path, std::vector<u8>& buffer)
+    {
+        std::ifstream file( file_path, std::ios::binary | std::ios::ate );
+        if ( !file )
+        {
+            return false;
+        }
+
+        buffer.resize( static_cast<size_t>( file.tellg() ) );
+        file.seekg( 0, std::ios::beg );
+        return static_cast<bool>( file.read( reinterpret_cast<char*>( buffer.data() ), buffer.size() ) ) || buffer.empty();
+    }
+
+    /// <summary>
+    /// Builds the archive that ImportDDS writes: everything before the DDS data, the new DDS data, then whatever was left of the original after the replaced range
+    /// </summary>
+    std::vector<u8> SpliceDDS(const u8* original, size_t original_size, size_t found_pos, const u8* dds, size_t dds_size)
+    {
+        std::vector<u8> result;
+        result.reserve( std::max( original_size, found_pos + dds_size ) );
+
+        result.insert( result.end(), original, original + found_pos );
+        result.insert( result.end(), dds, dds + dds_size );
+        if ( found_pos + dds_size < original_size )
+        {
+            result.insert( result.end(), original + found_pos + dds_size, original + original_size );
+        }
+
+        return result;
+    }
+
     /// <summary>
     /// This function extracts the DDS data into a new file, the filename being the original + the suffix "_extracted", + of course the file extension ".dds"
     /// </summary>
@@ -256,186 +418,1798 @@ namespace DDSExtractor
         }
     }
 
-    void RenameNMHBinToHash(fs::path& file_path)
+    /// <summary>
+    /// Reads the archive an import goes into. With as_patch the archive itself isn't modified, so the patch that earlier imports wrote for it
+    /// is applied to the working copy first, that way every texture imported into one archive ends up in the same patch
+    /// </summary>
+    bool LoadArchiveForImport(const fs::path& archive_path, std::vector<u8>& source_data, std::vector<u8>& working_data, bool as_patch)
+    {
+        if ( !ReadFileToBuffer( archive_path, source_data ) )
+        {
+            return false;
+        }
+
+        working_data = source_data;
+
+        patch::Patch existing_patch;
+        if ( as_patch && patch::Load( patch::PatchPathFor( archive_path ), existing_patch ) &&
+             existing_patch.source_size == source_data.size() && existing_patch.source_hash == checksum::XXH64( source_data ) )
+        {
+            patch::ApplyInMemory( existing_patch, working_data );
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Replaces the archive with the imported data, or with as_patch writes the difference to it as a .ddspatch next to it
+    /// </summary>
+    bool SaveImportedArchive(const fs::path& archive_path, const std::vector<u8>& source_data, const std::vector<u8>& output_data, bool as_patch)
+    {
+        if ( !as_patch )
+        {
+            return journal::WriteFileDurably( archive_path, output_data.data(), output_data.size() );
+        }
+
+        std::vector<u8> patch_data = patch::Serialize( patch::Create( source_data.data(), source_data.size(), output_data.data(), output_data.size() ) );
+        return journal::WriteFileDurably( patch::PatchPathFor( archive_path ), patch_data.data(), patch_data.size() );
+    }
+
+    /// <summary>
+    /// The archive ImportDDS writes, built in memory: the DDS data of the original is replaced with dds
+    /// </summary>
+    bool ImportDDSIntoBuffer(const fs::path& original_file_path, const u8* original, size_t original_size, const u8* dds, size_t dds_size, std::vector<u8>& output_data)
     {
-        fs::path new_name = file_path.parent_path() / (hasher::CalculateHashOriginal(file_path.string().c_str()) + ".bin");
-    
-        fs::rename(file_path, new_name);
+        size_t found_pos;
+        if ( !FindPatternInBuffer( original, original_size, found_pos ) )
+        {
+            parallel::Log( std::cerr, "DDS pattern not found in original file: " + original_file_path.string() );
+            return false;
+        }
+
+        output_data = SpliceDDS( original, original_size, found_pos, dds, dds_size );
+        return true;
     }
 
     /// <summary>
     /// This function re-imports DDS data (from a file, e.g. st00_extracted.dds) into its original file (in this case, it would be st00.BIN)
+    /// The archive is replaced in one step, so an interrupted import leaves the original archive intact, and importing the same DDS twice gives the same archive.
+    /// If the DDS is what the archive already contains, nothing is written.
     /// </summary>
-    void ImportDDS(const fs::path& original_file_path, const fs::path& dds_file_path)
+    bool ImportDDS(const fs::path& original_file_path, const fs::path& dds_file_path, bool as_patch = false)
     {
-        std::fstream original_file( original_file_path, std::ios::in | std::ios::out | std::ios::binary );
-        if ( !original_file )
+        std::vector<u8> source_data;
+        std::vector<u8> original_data;
+        if ( !LoadArchiveForImport( original_file_path, source_data, original_data, as_patch ) )
         {
-            std::cerr << "Error opening file: " << original_file_path << std::endl;
-            return;
+            parallel::Log( std::cerr, "Error opening file: " + original_file_path.string() );
+            return false;
         }
 
-        std::streampos found_pos;
-        if ( !FindPattern( original_file, found_pos ) )
+        std::vector<u8> new_dds_data;
+        if ( !ReadFileToBuffer( dds_file_path, new_dds_data ) )
         {
-            std::cerr << "DDS pattern not found in original file: " << original_file_path << std::endl;
-            return;
+            parallel::Log( std::cerr, "Error opening DDS file: " + dds_file_path.string() );
+            return false;
         }
 
-        std::ifstream dds_file( dds_file_path, std::ios::binary );
-        if ( !dds_file )
+        std::vector<u8> output_data;
+        if ( !ImportDDSIntoBuffer( original_file_path, original_data.data(), original_data.size(), new_dds_data.data(), new_dds_data.size(), output_data ) )
         {
-            std::cerr << "Error opening DDS file: " << dds_file_path << std::endl;
-            return;
+            return false;
+        }
+
+        if ( output_data == original_data )
+        {
+            parallel::Log( std::cout, "Unchanged, nothing to import into: " + original_file_path.string() );
+            return true;
+        }
+
+        if ( !SaveImportedArchive( original_file_path, source_data, output_data, as_patch ) )
+        {
+            parallel::Log( std::cerr, "Error reopening file for writing: " + original_file_path.string() );
+            return false;
         }
-        std::vector<u8> new_dds_data( ( std::istreambuf_iterator<char>( dds_file ) ),
-                                        std::istreambuf_iterator<char>() );
 
-        std::streamsize new_dds_size = new_dds_data.size();
+        parallel::Log( std::cout, ( as_patch ? "Wrote patch for: " : "Re-imported DDS data into: " ) + original_file_path.string() );
+        return true;
+    }
 
-        original_file.seekg( 0, std::ios::beg );
-        std::vector<u8> data_before_dds_bytes( static_cast<size_t>( found_pos ) );
-        original_file.read( reinterpret_cast<char*>( data_before_dds_bytes.data() ), found_pos );
-        original_file.close();
+    /// <summary>
+    /// Writes a texture named after its Replacement hash (e.g. 0256x0256_deadbeef.dds) back into every archive the index says it came from,
+    /// at the recorded offset. In a plain archive the DDS data runs to the end of the file, like for ImportDDS, so it can change size;
+    /// inside an RSL a larger texture would overwrite the members that follow it, so it's refused there. Archives the texture wouldn't change aren't written.
+    /// </summary>
+    bool ImportHashedDDS(const fs::path& dds_file_path, const hash_index::Index& index, bool as_patch = false)
+    {
+        // Other .dds files (e.g. st00_extracted.dds) aren't Replacement textures
+        if ( !hash_index::IsTextureName( hash_index::NormalizeName( dds_file_path.filename().u8string() ) ) )
+        {
+            return true;
+        }
 
-        std::ofstream output_file( original_file_path, std::ios::binary | std::ios::trunc );
-        if ( !output_file )
+        std::vector<hash_index::Location> locations = index.Lookup( dds_file_path.filename().u8string() );
+        if ( locations.empty() )
         {
-            std::cerr << "Error reopening file for writing: " << original_file_path << std::endl;
-            return;
+            parallel::Log( std::cout, "Not in the index, skipping: " + dds_file_path.string() );
+            return false;
+        }
+
+        std::vector<u8> new_dds_data;
+        if ( !ReadFileToBuffer( dds_file_path, new_dds_data ) )
+        {
+            parallel::Log( std::cerr, "Error opening DDS file: " + dds_file_path.string() );
+            return false;
         }
 
-        output_file.write( reinterpret_cast<const char*>( data_before_dds_bytes.data() ), data_before_dds_bytes.size() );
-        output_file.write( reinterpret_cast<const char*>( new_dds_data.data() ), new_dds_data.size() );
+        bool ok = true;
+        for ( const auto& location : locations )
+        {
+            std::vector<u8> source_data;
+            std::vector<u8> original_data;
+            if ( !LoadArchiveForImport( location.archive, source_data, original_data, as_patch ) )
+            {
+                parallel::Log( std::cerr, "Error opening file: " + location.archive.string() );
+                ok = false;
+                continue;
+            }
+
+            size_t found_pos = static_cast<size_t>( location.offset );
+            if ( found_pos + location.size > original_data.size() || !std::equal( DDS_MAGIC_PATTERN.begin(), DDS_MAGIC_PATTERN.end(), original_data.begin() + found_pos ) )
+            {
+                parallel::Log( std::cerr, "The archive changed since it was indexed, run --extracthashed again: " + location.archive.string() );
+                ok = false;
+                continue;
+            }
+
+            if ( new_dds_data.size() > location.size && rsl::IsArchive( original_data.data(), original_data.size() ) )
+            {
+                parallel::Log( std::cerr, "Error: " + dds_file_path.filename().string() + " is larger than the texture it replaces in " + location.archive.string() );
+                ok = false;
+                continue;
+            }
+
+            // Most textures in a tree written by --extracthashed are untouched, rewriting their archives would only change every write time
+            std::vector<u8> output_data = SpliceDDS( original_data.data(), original_data.size(), found_pos, new_dds_data.data(), new_dds_data.size() );
+            if ( output_data == original_data )
+            {
+                continue;
+            }
+
+            if ( !SaveImportedArchive( location.archive, source_data, output_data, as_patch ) )
+            {
+                parallel::Log( std::cerr, "Error reopening file for writing: " + location.archive.string() );
+                ok = false;
+                continue;
+            }
 
-        original_file.open( original_file_path, std::ios::in | std::ios::binary );
-        original_file.seekg( found_pos + new_dds_size );
-        std::vector<u8> remaining_data( ( std::istreambuf_iterator<char>( original_file ) ),
-                                          std::istreambuf_iterator<char>() );
-        output_file.write( reinterpret_cast<const char*>( remaining_data.data() ), remaining_data.size() );
+            parallel::Log( std::cout, std::string( as_patch ? "Wrote patch for " : "Re-imported " ) + dds_file_path.filename().string() + " into: " + location.archive.string() + " at position " + std::to_string( found_pos ) );
+        }
 
-        std::cout << "Re-imported DDS data into: " << original_file_path << std::endl;
+        return ok;
     }
 
-    void RemoveLast16BytesFromFile(const fs::path& nmh_bin_path)
+    bool WriteBufferToFile(const fs::path& output_file_path, const u8* data, size_t size)
     {
-        std::fstream file(nmh_bin_path, std::ios::in | std::ios::out | std::ios::binary);
+        std::ofstream output_file( output_file_path, std::ios::binary | std::ios::trunc );
+        return static_cast<bool>( output_file.write( reinterpret_cast<const char*>( data ), size ) );
+    }
 
-        file.seekg(0, std::ios::end);
-        std::streampos file_size = file.tellg();
+    /// <summary>
+    /// Fields of a DDS header that are interesting for --metadata and for matching replacement textures
+    /// </summary>
+    struct DDSInfo
+    {
+        bool valid = false;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipmap_count = 0;
+        uint32_t pixel_format_flags = 0;
+        uint32_t bit_count = 0;
+        char four_cc[5] = {};
+    };
 
-        std::streampos new_size = file_size - std::streamoff(16);
+    /// <summary>
+    /// Reads the header of DDS data that starts with the "DDS " magic
+    /// </summary>
+    DDSInfo ReadDDSInfo(const u8* dds, size_t size)
+    {
+        const size_t DDS_HEADER_SIZE = 128;
 
-        file.seekg(0, std::ios::beg);
-        std::vector<char> buffer(new_size);
-        file.read(buffer.data(), new_size);
-        file.close();
+        DDSInfo info;
+        binary::BinaryReader<binary::Endian::Little> reader( dds, size );
+        if ( size < DDS_HEADER_SIZE || !reader.MagicAt( 0, "DDS ", 4 ) )
+        {
+            return info;
+        }
 
-        std::ofstream out(nmh_bin_path, std::ios::out | std::ios::binary | std::ios::trunc);
-        out.write(buffer.data(), buffer.size());
+        info.valid = true;
+        info.height = reader.Read<uint32_t>( 12 );
+        info.width = reader.Read<uint32_t>( 16 );
+        info.mipmap_count = std::max( reader.Read<uint32_t>( 28 ), 1u );
+        info.pixel_format_flags = reader.Read<uint32_t>( 80 );
+        info.bit_count = reader.Read<uint32_t>( 88 );
+        if ( info.pixel_format_flags & 0x4 ) // DDPF_FOURCC
+        {
+            std::memcpy( info.four_cc, dds + 84, 4 );
+        }
 
-        std::cout << "Successfully removed the last 16 bytes from the file." << std::endl;
-        out.close();
+        return info;
     }
 
     /// <summary>
-    /// Once the program has been given a directory to work in, from the user, + the extraction mode, this function processes the given files and based on the extraction mode it does the necessary operation (extraction/reimport, etc.)
+    /// The texture that a file given to --compress replaces: the DDS in the archive next to a *_extracted file, or where the index says a Replacement name came from.
+    /// A Replacement name that isn't in the index still gives the dimensions. Returns an invalid DDSInfo if there's nothing to match
     /// </summary>
-    void ProcessDirectory(const fs::path& directory, const std::vector<std::string>& extensions, ExtractorMode extract_mode)
+    DDSInfo FindReplacedTexture(const fs::path& file_path, const hash_index::Index* index)
     {
-        for ( const auto& entry : fs::recursive_directory_iterator( directory ) )
+        DDSInfo info;
+
+        fs::path archive_path = FindExtractedSource( file_path, ArchiveExtensions() );
+        if ( !archive_path.empty() )
+        {
+            MappedFile archive( archive_path );
+            size_t found_pos;
+            if ( archive.IsValid() && FindPatternInBuffer( archive.Data(), archive.Size(), found_pos ) )
+            {
+                info = ReadDDSInfo( archive.Data() + found_pos, archive.Size() - found_pos );
+            }
+            return info;
+        }
+
+        std::string name = hash_index::NormalizeName( file_path.filename().u8string() );
+        if ( !hash_index::IsTextureName( name ) )
         {
-            if ( entry.is_regular_file() )
+            return info;
+        }
+
+        if ( index != nullptr )
+        {
+            for ( const hash_index::Location& location : index->Lookup( name ) )
             {
-                fs::path file_path = entry.path();
-                if ( std::find( extensions.begin(), extensions.end(), file_path.extension().string() ) != extensions.end() )
+                MappedFile archive( location.archive );
+                if ( archive.IsValid() && location.offset + location.size <= archive.Size() )
                 {
-                    switch ( extract_mode )
+                    info = ReadDDSInfo( archive.Data() + location.offset, location.size );
+                    if ( info.valid )
                     {
-                        case ExtractorMode::EXTRACT:
-                        {
-                            std::ifstream file( file_path, std::ios::binary );
-
-                            if ( !file )
-                            {
-                                std::cerr << "Error opening file: " << file_path << std::endl;
-                                continue;
-                            }
-
-                            std::streampos found_pos;
-                            if ( FindPattern( file, found_pos ) )
-                            {
-                                std::cout << "DDS pattern found in file: " << file_path << " at position " << found_pos << std::endl;
-                                ExtractDDS( file_path, found_pos );
-                            }
-                            else
-                            {
-                                std::cout << "DDS pattern not found in file: " << file_path << std::endl;
-                            }
-                            break;
-                        }
-                        case ExtractorMode::EXTRACT_HASHED:
-                        {
-                            std::ifstream file(file_path, std::ios::binary);
-
-                            if (!file)
-                            {
-                                std::cerr << "Error opening file: " << file_path << std::endl;
-                                continue;
-                            }
-
-                            std::streampos found_pos;
-                            if (FindPattern(file, found_pos))
-                            {
-                                std::cout << "DDS pattern found in file: " << file_path << " at position " << found_pos << std::endl;
-                                ExtractDDSHashed(file_path, found_pos);
-                            }
-                            else
-                            {
-                                std::cout << "DDS pattern not found in file: " << file_path << std::endl;
-                            }
-                            break;
-                        }
-                        case ExtractorMode::IMPORT:
-                        {
-                            fs::path dds_file_path = file_path.parent_path() / ( file_path.stem().string() + "_extracted.dds" );
-                            if ( fs::exists( dds_file_path ) )
-                            {
-                                ImportDDS( file_path, dds_file_path );
-                            }
-                            break;
-                        }
-                        case ExtractorMode::NMH_FIX_AND_HASH:
-                        {
-                            RemoveLast16BytesFromFile( file_path );
-                            RenameNMHBinToHash( file_path );
-                            break;
-                        }
-                        case ExtractorMode::BIG_TO_LITTLE_ENDIAN:
-                        {
-                            fs::path out = file_path.parent_path() / (file_path.stem().string() + "_le.bin");
-                            convertBigEndianToLittleEndian(file_path, out);
-                            break;
-                        }
-                        case ExtractorMode::GM2:
-                        {
-                            // ExtractGCT0FromArchive(file_path);
-                            break;
-                        }
-                        case ExtractorMode::BIN_TO_DDS:
-                        {
-                            GCT0CMPRToDXT1DDS(file_path);
-                            break;
-                        }
-                        default:
-                        {
-                            std::cerr << "Unsupported mode." << std::endl;
-                            break;
-                        }
+                        return info;
                     }
                 }
             }
         }
+
+        info.valid = true;
+        info.width = static_cast<uint32_t>( std::stoul( name.substr( 0, 4 ) ) );
+        info.height = static_cast<uint32_t>( std::stoul( name.substr( 5, 4 ) ) );
+        info.mipmap_count = 1;
+        return info;
+    }
+
+    /// <summary>
+    /// --compress: encodes an uncompressed texture (.tga, or a .dds that isn't block compressed) as DXT1, or DXT5 where it needs alpha, into a .dds of the same name.
+    /// An uncompressed .dds is copied to <name>.dds.orig first, since its output replaces it. If it replaces a texture (see FindReplacedTexture), the output gets that texture's dimensions, mip count and format, so --import/--importhashed take it as is
+    /// </summary>
+    bool CompressTexture(const fs::path& file_path, const ProcessOptions& options)
+    {
+        bool is_tga = walker::ExtensionSet{ ".tga" }.Matches( file_path );
+        fs::path output_path = file_path.parent_path() / ( file_path.stem().string() + ".dds" );
+
+        // A .dds with a .tga next to it is that .tga's output
+        if ( !is_tga && fs::exists( file_path.parent_path() / ( file_path.stem().string() + ".tga" ) ) )
+        {
+            return true;
+        }
+
+        texture::Image image;
+        {
+            MappedFile file( file_path );
+            if ( !file.IsValid() )
+            {
+                parallel::Log( std::cerr, "Error opening file: " + file_path.string() );
+                return false;
+            }
+
+            if ( is_tga ? !texture::LoadTGA( file.Data(), file.Size(), image ) : !texture::LoadUncompressedDDS( file.Data(), file.Size(), image ) )
+            {
+                // Block compressed .dds files are what this mode writes
+                if ( is_tga )
+                {
+                    parallel::Log( std::cerr, "Unsupported TGA (only 24/32-bit truecolor, plain or RLE): " + file_path.string() );
+                }
+                return !is_tga;
+            }
+        }
+
+        DDSInfo reference = FindReplacedTexture( file_path, options.index );
+        uint32_t width = reference.valid ? reference.width : image.width;
+        uint32_t height = reference.valid ? reference.height : image.height;
+        uint32_t mipmap_count = reference.valid ? reference.mipmap_count : 1;
+
+        // Keep the format of the texture that is replaced, otherwise DXT1 unless there's alpha
+        bc::Format format = image.HasAlpha() ? bc::Format::BC3 : bc::Format::BC1;
+        if ( std::strcmp( reference.four_cc, "DXT1" ) == 0 )
+        {
+            format = bc::Format::BC1;
+        }
+        else if ( std::strcmp( reference.four_cc, "DXT3" ) == 0 )
+        {
+            format = bc::Format::BC2;
+        }
+        else if ( std::strcmp( reference.four_cc, "DXT5" ) == 0 )
+        {
+            format = bc::Format::BC3;
+        }
+        else if ( reference.valid && reference.four_cc[0] != 0 )
+        {
+            parallel::Log( std::cout, "Warning: " + file_path.string() + " replaces a " + reference.four_cc + " texture, writing " + bc::ToString( format ) );
+        }
+
+        if ( width == 0 || height == 0 )
+        {
+            parallel::Log( std::cerr, "Error: The texture replaced by " + file_path.string() + " has no size" );
+            return false;
+        }
+
+        if ( width != image.width || height != image.height )
+        {
+            parallel::Log( std::cout, "Resizing " + file_path.string() + " from " + std::to_string( image.width ) + "x" + std::to_string( image.height ) +
+                                      " to " + std::to_string( width ) + "x" + std::to_string( height ) );
+            image = texture::Resize( image, width, height );
+        }
+
+        // The output of an uncompressed .dds has its name (the one --import looks for), the lossless original is kept as <name>.dds.orig
+        if ( !is_tga )
+        {
+            fs::path backup_path = file_path;
+            backup_path += ".orig";
+
+            std::error_code error;
+            fs::copy_file( file_path, backup_path, fs::copy_options::overwrite_existing, error );
+            if ( error )
+            {
+                parallel::Log( std::cerr, "Error: Could not keep the original as " + backup_path.string() + ", not compressing " + file_path.string() );
+                return false;
+            }
+        }
+
+        std::vector<u8> dds = bc::CompressToDDS( image, mipmap_count, format, options.quality );
+        if ( !journal::WriteFileDurably( output_path, dds.data(), dds.size() ) )
+        {
+            parallel::Log( std::cerr, "Error writing to file: " + output_path.string() );
+            return false;
+        }
+
+        parallel::Log( std::cout, "Compressed " + file_path.string() + " -> " + output_path.string() + " (" + bc::ToString( format ) +
+                                  ", " + std::to_string( width ) + "x" + std::to_string( height ) + ", " + std::to_string( mipmap_count ) + " mips)" );
+        return true;
+    }
+
+    /// <summary>
+    /// Decodes the texture in an archive (the embedded DDS) or in a GCT0 CMPR file (converted to DXT1 the same way as --bintodds) to RGBA
+    /// </summary>
+    bool DecodeTextureFromBuffer(const u8* data, size_t size, texture::Image& image)
+    {
+        size_t found_pos;
+        if ( FindPatternInBuffer( data, size, found_pos ) )
+        {
+            return bc::DecodeDDS( data + found_pos, size - found_pos, image );
+        }
+
+        classifier::FileClass file_class = classifier::ClassifyBuffer( data, std::min( size, classifier::SNIFF_SIZE ) );
+        if ( file_class != classifier::FileClass::GCT0 && file_class != classifier::FileClass::GCT0_NULL )
+        {
+            return false;
+        }
+
+        try
+        {
+            std::vector<u8> dds_data = GCT0CMPRBufferToDXT1DDS( data, size );
+            return !dds_data.empty() && bc::DecodeDDS( dds_data.data(), dds_data.size(), image );
+        }
+        catch ( const std::runtime_error& )
+        {
+            return false;
+        }
+    }
+
+    /// <summary>
+    /// Loads anything --pixeldiff can compare: a .tga, a .dds, or an archive/GCT0 file with a texture in it
+    /// </summary>
+    bool LoadImageFile(const fs::path& file_path, texture::Image& image)
+    {
+        MappedFile file( file_path );
+        if ( !file.IsValid() )
+        {
+            return false;
+        }
+
+        if ( walker::ExtensionSet{ ".tga" }.Matches( file_path ) )
+        {
+            return texture::LoadTGA( file.Data(), file.Size(), image );
+        }
+
+        return DecodeTextureFromBuffer( file.Data(), file.Size(), image );
+    }
+
+    /// <summary>
+    /// --preview: decodes the texture of an archive and writes it next to it as <name>_preview.tga (or .ppm), and adds it to the contact sheet if there is one
+    /// </summary>
+    bool PreviewFromBuffer(const fs::path& file_path, const u8* data, size_t size, const ProcessOptions& options)
+    {
+        texture::Image image;
+        if ( !DecodeTextureFromBuffer( data, size, image ) )
+        {
+            parallel::Log( std::cout, "No texture that can be decoded in file: " + file_path.string() );
+            return true;
+        }
+
+        std::vector<u8> encoded = options.ppm ? texture::EncodePPM( image ) : texture::EncodeTGA( image );
+        fs::path output_file_path = file_path.parent_path() / ( file_path.stem().string() + ( options.ppm ? "_preview.ppm" : "_preview.tga" ) );
+        if ( !WriteBufferToFile( output_file_path, encoded.data(), encoded.size() ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not save file: " + output_file_path.string() );
+            return false;
+        }
+
+        if ( options.contact_sheet != nullptr )
+        {
+            options.contact_sheet->Add( file_path.string(), image );
+        }
+
+        parallel::Log( std::cout, "Wrote preview to: " + output_file_path.string() );
+        return true;
+    }
+
+    /// <summary>
+    /// Writes the pages of a contact sheet, e.g. contact_sheet_000.tga, contact_sheet_001.tga
+    /// </summary>
+    bool WriteContactSheet(const texture::ContactSheet& contact_sheet, bool ppm)
+    {
+        std::vector<texture::Image> pages = contact_sheet.Pages();
+        for ( size_t i = 0; i < pages.size(); ++i )
+        {
+            std::vector<u8> encoded = ppm ? texture::EncodePPM( pages[i] ) : texture::EncodeTGA( pages[i] );
+            fs::path page_path = contact_sheet.OutputStem();
+            page_path += "_" + rsl::IndexName( i ) + ( ppm ? ".ppm" : ".tga" );
+            if ( !WriteBufferToFile( page_path, encoded.data(), encoded.size() ) )
+            {
+                std::cerr << "Error: Could not save file: " << page_path.string() << std::endl;
+                return false;
+            }
+        }
+
+        std::cout << "Wrote a contact sheet of " << contact_sheet.Count() << " textures on " << pages.size() << " page(s) to " << contact_sheet.OutputStem().string() << "_*" << std::endl;
+        return true;
+    }
+
+    /// <summary>
+    /// Where extracted data goes instead of a file, e.g. a buffer for --verify
+    /// </summary>
+    using OutputSink = std::function<bool(const fs::path& output_file_path, const u8* data, size_t size)>;
+
+    /// <summary>
+    /// --extract on data that is already in memory. With a sink nothing is written or logged, the sink gets what would have been written
+    /// </summary>
+    bool ExtractDDSFromBuffer(const fs::path& file_path, const u8* data, size_t size, const OutputSink& sink = nullptr)
+    {
+        size_t found_pos;
+        if ( !FindPatternInBuffer( data, size, found_pos ) )
+        {
+            if ( !sink )
+            {
+                parallel::Log( std::cout, "DDS pattern not found in file: " + file_path.string() );
+            }
+            return true;
+        }
+
+        fs::path output_file_path = file_path.parent_path() / ( file_path.stem().string() + "_extracted.dds" );
+        if ( sink )
+        {
+            return sink( output_file_path, data + found_pos, size - found_pos );
+        }
+
+        if ( !WriteBufferToFile( output_file_path, data + found_pos, size - found_pos ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not save file: " + output_file_path.string() );
+            return false;
+        }
+
+        parallel::Log( std::cout, "DDS pattern found in file: " + file_path.string() + " at position " + std::to_string( found_pos ) + "\nExtracted DDS data to: " + output_file_path.string() );
+        return true;
+    }
+
+    /// <summary>
+    /// Checks that --extract followed by --import gives back the same archive, without writing any texture or archive:
+    /// ExtractDDSFromBuffer writes into memory instead of a file, that is imported like ImportDDS would, and the checksums of both archives are compared.
+    /// The stream based FindPattern has to find the texture at the same position as the in-memory search.
+    /// </summary>
+    bool VerifyRoundTrip(const fs::path& file_path, const u8* data, size_t size, std::string& message)
+    {
+        bool extracted = false;
+        std::vector<u8> extracted_data;
+        OutputSink to_memory = [&](const fs::path&, const u8* output, size_t output_size)
+        {
+            extracted = true;
+            extracted_data.assign( output, output + output_size );
+            return true;
+        };
+
+        if ( !ExtractDDSFromBuffer( file_path, data, size, to_memory ) || !extracted )
+        {
+            message = "DDS pattern not found in file: " + file_path.string();
+            return true;
+        }
+
+        size_t found_pos;
+        FindPatternInBuffer( data, size, found_pos );
+        std::istringstream stream( std::string( reinterpret_cast<const char*>( data ), size ) );
+        std::streampos stream_pos;
+        if ( !FindPattern( stream, stream_pos ) || static_cast<size_t>( stream_pos ) != found_pos )
+        {
+            message = "Pattern search mismatch in " + file_path.string() + ": in memory at " + std::to_string( found_pos ) + ", from a stream at " + std::to_string( static_cast<std::streamoff>( stream_pos ) );
+            return false;
+        }
+
+        std::vector<u8> reimported;
+        if ( !ImportDDSIntoBuffer( file_path, data, size, extracted_data.data(), extracted_data.size(), reimported ) )
+        {
+            message = "Re-import failed for " + file_path.string();
+            return false;
+        }
+
+        uint64_t original_checksum = checksum::XXH64( data, size );
+        uint64_t reimported_checksum = checksum::XXH64( reimported );
+        if ( reimported.size() != size || original_checksum != reimported_checksum )
+        {
+            message = "Round trip mismatch in " + file_path.string() + ": original " + checksum::ToHex( original_checksum ) + ", re-imported " + checksum::ToHex( reimported_checksum );
+            return false;
+        }
+
+        // Extracting again from the re-imported archive has to give back the same DDS data
+        std::vector<u8> first_extraction = std::move( extracted_data );
+        extracted = false;
+        if ( !ExtractDDSFromBuffer( file_path, reimported.data(), reimported.size(), to_memory ) || !extracted || extracted_data != first_extraction )
+        {
+            message = "Re-extraction mismatch in " + file_path.string();
+            return false;
+        }
+
+        message = "OK " + file_path.string() + " (" + checksum::ToHex( original_checksum ) + ")";
+        return true;
+    }
+
+    bool VerifyRoundTrip(const fs::path& file_path, std::string& message)
+    {
+        MappedFile file( file_path );
+        if ( !file.IsValid() )
+        {
+            message = "Error opening file: " + file_path.string();
+            return false;
+        }
+
+        return VerifyRoundTrip( file_path, file.Data(), file.Size(), message );
+    }
+
+    /// <summary>
+    /// --extracthashed on data that is already in memory. The name is the hash of the whole archive, same as ExtractDDSHashed
+    /// </summary>
+    bool ExtractDDSHashedFromBuffer(const fs::path& file_path, const u8* data, size_t size)
+    {
+        size_t found_pos;
+        if ( !FindPatternInBuffer( data, size, found_pos ) )
+        {
+            parallel::Log( std::cout, "DDS pattern not found in file: " + file_path.string() );
+            return true;
+        }
+
+        hasher::TextureHash texture_hash = hasher::HashTextureBuffer( data, size );
+        if ( texture_hash.name.empty() )
+        {
+            parallel::Log( std::cout, "DDS pattern found, but there's no valid GCT0 header to name the texture after: " + file_path.string() );
+            return true;
+        }
+
+        fs::path output_file_path = file_path.parent_path() / ( texture_hash.name + ".dds" );
+        if ( !WriteBufferToFile( output_file_path, data + found_pos, size - found_pos ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not save file: " + output_file_path.string() );
+            return false;
+        }
+
+        parallel::Log( std::cout, "DDS pattern found in file: " + file_path.string() + " at position " + std::to_string( found_pos ) + "\nExtracted DDS data to: " + output_file_path.string() );
+        return true;
+    }
+
+    /// <summary>
+    /// e.g. "0256x0256_deadbeef (K7TX trimmed, big endian words, header at 0x120)"
+    /// </summary>
+    std::string FormatHashCandidate(const hasher::HashCandidate& candidate)
+    {
+        std::ostringstream text;
+        text << candidate.name << " (" << hasher::ToString( candidate.variant ) << ", " << ( candidate.word_endian == binary::Endian::Little ? "little" : "big" ) << " endian words";
+        if ( candidate.header_offset != 0 )
+        {
+            text << ", header at 0x" << std::hex << candidate.header_offset;
+        }
+        text << ")";
+        return text.str();
+    }
+
+    /// <summary>
+    /// --metadata: writes what the tool knows about an archive (content type, DDS position and header, Replacement name) to a text file next to it, e.g. st00_metadata.txt
+    /// </summary>
+    bool WriteMetadataFromBuffer(const fs::path& file_path, const u8* data, size_t size)
+    {
+        std::ostringstream metadata;
+        metadata << "file: " << file_path.filename().string() << "\n";
+        metadata << "size: " << size << "\n";
+        metadata << "content: " << classifier::ToString( classifier::ClassifyBuffer( data, std::min( size, classifier::SNIFF_SIZE ) ) ) << "\n";
+        metadata << "checksum: " << checksum::ToHex( checksum::XXH64( data, size ) ) << "\n";
+
+        hasher::TextureHash texture_hash = hasher::HashTextureBuffer( data, size );
+        if ( !texture_hash.name.empty() )
+        {
+            metadata << "replacement_name: " << texture_hash.name << "\n";
+        }
+
+        for ( const hasher::HashCandidate& candidate : hasher::HashVariants( data, size, file_path.extension().string() ) )
+        {
+            metadata << "replacement_candidate: " << FormatHashCandidate( candidate ) << "\n";
+        }
+
+        size_t found_pos;
+        if ( FindPatternInBuffer( data, size, found_pos ) )
+        {
+            DDSInfo info = ReadDDSInfo( data + found_pos, size - found_pos );
+            metadata << "dds_offset: " << found_pos << "\n";
+            metadata << "dds_size: " << size - found_pos << "\n";
+            if ( info.valid )
+            {
+                metadata << "dds_width: " << info.width << "\n";
+                metadata << "dds_height: " << info.height << "\n";
+                metadata << "dds_mipmaps: " << info.mipmap_count << "\n";
+                metadata << "dds_format: " << ( info.four_cc[0] != '\0' ? info.four_cc : "uncompressed" ) << "\n";
+            }
+        }
+
+        fs::path output_file_path = file_path.parent_path() / ( file_path.stem().string() + "_metadata.txt" );
+        std::string text = metadata.str();
+        if ( !WriteBufferToFile( output_file_path, reinterpret_cast<const u8*>( text.data() ), text.size() ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not save file: " + output_file_path.string() );
+            return false;
+        }
+
+        parallel::Log( std::cout, "Wrote metadata to: " + output_file_path.string() );
+        return true;
+    }
+
+    /// <summary>
+    /// --bintodds on data that is already in memory, the output goes to the working directory like GCT0CMPRToDXT1DDS
+    /// </summary>
+    bool ConvertGCT0FromBuffer(const fs::path& file_path, const u8* data, size_t size)
+    {
+        std::vector<u8> dds_data = GCT0CMPRBufferToDXT1DDS( data, size );
+        if ( dds_data.empty() )
+        {
+            return true;
+        }
+
+        fs::path output_file_path = file_path.stem().string() + ".dds";
+        if ( !WriteBufferToFile( output_file_path, dds_data.data(), dds_data.size() ) )
+        {
+            throw std::runtime_error( "Failed to write output file: " + output_file_path.string() );
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// --btole on data that is already in memory: reverses the byte order of every 4-byte word, like convertBigEndianToLittleEndian
+    /// </summary>
+    bool ConvertBigEndianToLittleEndianFromBuffer(const fs::path& file_path, const u8* data, size_t size)
+    {
+        const size_t wordSize = 4;
+
+        std::vector<u8> converted( data, data + size );
+        for ( size_t i = 0; i < size; i += wordSize )
+        {
+            std::reverse( converted.begin() + i, converted.begin() + std::min( i + wordSize, size ) );
+        }
+
+        fs::path output_file_path = file_path.parent_path() / ( file_path.stem().string() + "_le.bin" );
+        if ( !WriteBufferToFile( output_file_path, converted.data(), converted.size() ) )
+        {
+            parallel::Log( std::cerr, "Error: Cannot open output file " + output_file_path.string() );
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Removes the 16 bytes of padding and renames the file to its hash. The file is read once, the trailing 16 bytes are checked to really be zero padding, 
+    /// and the hash is calculated from the data that is already in memory. If emit_dds is set, the DXT1 DDS is written from the same buffer as well.
+    /// Files that are already named after their hash, have no GCT0 header to name them after or don't end with 16 zero bytes are left alone, so running this twice over the same folder is safe
+    /// even if a texture's data happens to end with 16 zero bytes.
+    /// The fixed data is written under the hash name and the original is only removed after that, so an interruption leaves either the untouched original
+    /// (which is simply processed again) or a finished hashed file. The hashed file is also journaled before it appears, for --resume.
+    /// </summary>
+    bool FixAndHashNMHBin(const fs::path& nmh_bin_path, bool emit_dds, journal::Journal* journal = nullptr)
+    {
+        const size_t PADDING_SIZE = 16;
+
+        std::vector<u8> buffer;
+        if ( !ReadFileToBuffer( nmh_bin_path, buffer ) )
+        {
+            parallel::Log( std::cerr, "Error opening file: " + nmh_bin_path.string() );
+            return false;
+        }
+
+        // Already fixed and renamed: its data may really end in 16 zero bytes, which must not be cut off again on every run
+        hasher::TextureHash current_hash = hasher::HashTextureBuffer( buffer.data(), buffer.size() );
+        if ( !current_hash.name.empty() && nmh_bin_path.stem().string() == current_hash.name )
+        {
+            parallel::Log( std::cout, "Already named after its hash, skipping: " + nmh_bin_path.string() );
+            return true;
+        }
+
+        if ( buffer.size() < PADDING_SIZE || std::any_of( buffer.end() - PADDING_SIZE, buffer.end(), [](u8 b) { return b != 0; } ) )
+        {
+            parallel::Log( std::cout, "Last 16 bytes are not empty padding, skipping: " + nmh_bin_path.string() );
+            return false;
+        }
+
+        buffer.resize( buffer.size() - PADDING_SIZE );
+
+        // Without a name the file would be rewritten shorter under its own name, and cut again on every run
+        hasher::TextureHash texture_hash = hasher::HashTextureBuffer( buffer.data(), buffer.size() );
+        if ( texture_hash.name.empty() )
+        {
+            parallel::Log( std::cout, "No valid GCT0 header to name the file after, skipping: " + nmh_bin_path.string() );
+            return false;
+        }
+
+        fs::path new_name = nmh_bin_path.parent_path() / ( texture_hash.name + ".bin" );
+
+        std::string dds_message;
+        if ( emit_dds )
+        {
+            std::vector<u8> dds_data = GCT0CMPRBufferToDXT1DDS( buffer.data(), buffer.size() );
+            if ( !dds_data.empty() )
+            {
+                fs::path dds_path = nmh_bin_path.parent_path() / ( texture_hash.name + ".dds" );
+                if ( !WriteBufferToFile( dds_path, dds_data.data(), dds_data.size() ) )
+                {
+                    parallel::Log( std::cerr, "Error: Could not save file: " + dds_path.string() );
+                    return false;
+                }
+                dds_message = ", converted to " + dds_path.filename().string();
+            }
+        }
+
+        std::string mode_name = GetModeName( emit_dds ? ExtractorMode::NMH_FIX_AND_HASH_DDS : ExtractorMode::NMH_FIX_AND_HASH );
+        bool written = journal::WriteFileDurably( new_name, buffer.data(), buffer.size(), [&](const journal::FileStamp& stamp)
+        {
+            if ( journal != nullptr )
+            {
+                journal->Record( new_name, mode_name, stamp, true, true );
+            }
+        } );
+
+        if ( !written )
+        {
+            parallel::Log( std::cerr, "Error: Could not save file: " + new_name.string() );
+            return false;
+        }
+
+        // A file that already had its hash name was replaced in place
+        std::error_code error;
+        bool same_file = new_name == nmh_bin_path || fs::equivalent( nmh_bin_path, new_name, error ) || error;
+        if ( !same_file )
+        {
+            fs::remove( nmh_bin_path, error );
+        }
+
+        parallel::Log( std::cout, "Removed the last 16 bytes and renamed " + nmh_bin_path.string() + " to " + new_name.filename().string() + dds_message );
+        return true;
+    }
+
+    /// <summary>
+    /// Adds the texture in data (a whole file, or an RSL member that starts at base_offset in the archive) to the reverse index, under the name --extracthashed gives it
+    /// and every other name the Replacement loader might look it up by, so a texture named after any of the hash variants can be found and imported
+    /// </summary>
+    void IndexTexture(hash_index::IndexBuilder& index_builder, const fs::path& archive_path, size_t base_offset, const u8* data, size_t size)
+    {
+        size_t found_pos;
+        if ( !FindPatternInBuffer( data, size, found_pos ) )
+        {
+            return;
+        }
+
+        for ( const hasher::HashCandidate& candidate : hasher::HashVariants( data, size, base_offset == 0 ? archive_path.extension().string() : std::string() ) )
+        {
+            index_builder.Add( candidate.name, archive_path, base_offset + found_pos, static_cast<uint32_t>( size - found_pos ) );
+        }
+    }
+
+    /// <summary>
+    /// Fingerprint of the texture in data (a whole file, or an RSL member that starts at base_offset in the archive) for --diff. Returns false if there's no DDS in it
+    /// </summary>
+    bool CatalogTexture(const std::string& member, size_t base_offset, const u8* data, size_t size, catalog::Texture& texture)
+    {
+        size_t found_pos;
+        if ( !FindPatternInBuffer( data, size, found_pos ) )
+        {
+            return false;
+        }
+
+        DDSInfo info = ReadDDSInfo( data + found_pos, size - found_pos );
+        texture.member = member;
+        texture.offset = base_offset + found_pos;
+        texture.size = size - found_pos;
+        texture.width = info.width;
+        texture.height = info.height;
+        texture.mipmap_count = info.mipmap_count;
+        texture.format = info.four_cc[0] != '\0' ? info.four_cc : "uncompressed";
+        texture.hash = checksum::XXH64( data + found_pos, size - found_pos );
+
+        texture.name = hasher::HashTextureBuffer( data, size ).name;
+        return true;
+    }
+
+    /// <summary>
+    /// Fingerprints every texture in a tree, RSL members included. Archives that haven't changed since the catalog cached in the tree was written aren't read again,
+    /// and the catalog is saved back afterwards so the next run can do the same. Nothing else is written
+    /// </summary>
+    catalog::Catalog BuildCatalog(const fs::path& root, unsigned max_threads = 0)
+    {
+        fs::path catalog_path = root / catalog::CATALOG_FILE_NAME;
+        catalog::Catalog cached;
+        catalog::Load( catalog_path, cached );
+
+        walker::ExtensionSet extensions = ArchiveExtensions();
+        extensions.Add( ".rsl" );
+        std::vector<fs::path> files = walker::CollectFiles( root, extensions );
+
+        catalog::Catalog result;
+        std::mutex result_mutex;
+        std::atomic<size_t> reused( 0 );
+
+        parallel::ForEach( files, [&](const fs::path& file_path)
+        {
+            std::string relative_path = catalog::RelativePath( root, file_path );
+            journal::FileStamp stamp = journal::StampOf( file_path );
+
+            catalog::Archive archive;
+            if ( const catalog::Archive* cached_archive = cached.Find( relative_path, stamp ) )
+            {
+                archive = *cached_archive;
+                ++reused;
+            }
+            else
+            {
+                MappedFile file( file_path );
+                if ( !file.IsValid() )
+                {
+                    parallel::Log( std::cerr, "Error opening file: " + file_path.string() );
+                    return;
+                }
+
+                archive.stamp = stamp;
+                catalog::Texture texture;
+                std::vector<rsl::Member> members;
+                if ( rsl::ReadMembers( file.Data(), file.Size(), members ) )
+                {
+                    for ( const rsl::Member& member : members )
+                    {
+                        if ( CatalogTexture( member.name, static_cast<size_t>( member.data - file.Data() ), member.data, member.size, texture ) )
+                        {
+                            archive.textures.push_back( texture );
+                        }
+                    }
+                }
+                else if ( CatalogTexture( std::string(), 0, file.Data(), file.Size(), texture ) )
+                {
+                    archive.textures.push_back( texture );
+                }
+            }
+
+            std::lock_guard<std::mutex> lock( result_mutex );
+            result.archives[relative_path] = std::move( archive );
+        }, max_threads );
+
+        if ( !catalog::Save( catalog_path, result ) )
+        {
+            parallel::Log( std::cerr, "Warning: Could not write " + catalog_path.string() + ", the next --diff will read every archive again" );
+        }
+
+        parallel::Log( std::cout, root.string() + ": " + std::to_string( files.size() ) + " archives, " + std::to_string( files.size() - reused ) + " read, " + std::to_string( reused ) + " unchanged since the last catalog" );
+        return result;
+    }
+
+    std::string DescribeTexture(const catalog::Texture& texture)
+    {
+        return std::to_string( texture.width ) + "x" + std::to_string( texture.height ) + " " + texture.format + ", " + std::to_string( texture.mipmap_count ) + " mips, "
+            + std::to_string( texture.size ) + " bytes at " + std::to_string( texture.offset ) + ( texture.name.empty() ? "" : ", " + texture.name );
+    }
+
+    /// <summary>
+    /// --diff: which textures were added, removed, moved or changed between two trees (e.g. two versions of the game). Both trees are cataloged at the same time,
+    /// each with half of the threads. Returns the number of differences. Throws fs::filesystem_error if a tree can't be listed
+    /// </summary>
+    size_t DiffTrees(const fs::path& old_root, const fs::path& new_root)
+    {
+        catalog::Catalog old_catalog;
+        catalog::Catalog new_catalog;
+        std::error_code error;
+        if ( fs::equivalent( old_root, new_root, error ) )
+        {
+            // Both would write the same catalog file
+            old_catalog = new_catalog = BuildCatalog( new_root );
+        }
+        else
+        {
+            // Either tree may fail to be listed, the old one's error is passed on from its thread and the thread is always joined
+            unsigned half = std::max( 1u, parallel::WorkerCount() / 2 );
+            std::exception_ptr old_error;
+            std::thread old_thread( [&]()
+            {
+                try
+                {
+                    old_catalog = BuildCatalog( old_root, half );
+                }
+                catch ( const std::exception& )
+                {
+                    old_error = std::current_exception();
+                }
+            } );
+
+            std::exception_ptr new_error;
+            try
+            {
+                new_catalog = BuildCatalog( new_root, half );
+            }
+            catch ( const std::exception& )
+            {
+                new_error = std::current_exception();
+            }
+
+            old_thread.join();
+            if ( old_error || new_error )
+            {
+                std::rethrow_exception( old_error ? old_error : new_error );
+            }
+        }
+
+        size_t unchanged = 0;
+        std::vector<catalog::Change> changes = catalog::Diff( old_catalog, new_catalog, unchanged );
+
+        size_t counts[4] = {};
+        for ( const catalog::Change& change : changes )
+        {
+            ++counts[static_cast<size_t>( change.kind )];
+            switch ( change.kind )
+            {
+                case catalog::Change::Kind::ADDED:
+                    std::cout << "added    " << change.new_location << " (" << DescribeTexture( *change.new_texture ) << ")" << std::endl;
+                    break;
+                case catalog::Change::Kind::REMOVED:
+                    std::cout << "removed  " << change.old_location << " (" << DescribeTexture( *change.old_texture ) << ")" << std::endl;
+                    break;
+                case catalog::Change::Kind::MOVED:
+                    std::cout << "moved    " << change.old_location << " @ " << change.old_texture->offset << " -> " << change.new_location << " @ " << change.new_texture->offset << std::endl;
+                    break;
+                case catalog::Change::Kind::CHANGED:
+                    std::cout << "changed  " << change.old_location << " (" << DescribeTexture( *change.old_texture ) << " -> " << DescribeTexture( *change.new_texture ) << ")" << std::endl;
+                    break;
+            }
+        }
+
+        std::cout << counts[static_cast<size_t>( catalog::Change::Kind::ADDED )] << " added, " << counts[static_cast<size_t>( catalog::Change::Kind::REMOVED )] << " removed, "
+                  << counts[static_cast<size_t>( catalog::Change::Kind::MOVED )] << " moved, " << counts[static_cast<size_t>( catalog::Change::Kind::CHANGED )] << " changed, "
+                  << unchanged << " unchanged" << std::endl;
+        return changes.size();
+    }
+
+    /// <summary>
+    /// Modes that only read the archive. Any number of these can run on one file, sharing a single mapping of it
+    /// </summary>
+    bool ModeReadsOnly(ExtractorMode extract_mode)
+    {
+        switch ( extract_mode )
+        {
+            case ExtractorMode::EXTRACT:
+            case ExtractorMode::EXTRACT_HASHED:
+            case ExtractorMode::METADATA:
+            case ExtractorMode::BIN_TO_DDS:
+            case ExtractorMode::VERIFY:
+            case ExtractorMode::BIG_TO_LITTLE_ENDIAN:
+            case ExtractorMode::PREVIEW:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /// <summary>
+    /// Runs a read-only mode on a file that is already in memory. Returns false if the mode failed for this file
+    /// </summary>
+    bool ProcessBuffer(const fs::path& file_path, const u8* data, size_t size, ExtractorMode extract_mode, const ProcessOptions& options = {})
+    {
+        switch ( extract_mode )
+        {
+            case ExtractorMode::EXTRACT: return ExtractDDSFromBuffer( file_path, data, size );
+            case ExtractorMode::EXTRACT_HASHED: return ExtractDDSHashedFromBuffer( file_path, data, size );
+            case ExtractorMode::METADATA: return WriteMetadataFromBuffer( file_path, data, size );
+            case ExtractorMode::BIN_TO_DDS: return ConvertGCT0FromBuffer( file_path, data, size );
+            case ExtractorMode::BIG_TO_LITTLE_ENDIAN: return ConvertBigEndianToLittleEndianFromBuffer( file_path, data, size );
+            case ExtractorMode::PREVIEW: return PreviewFromBuffer( file_path, data, size, options );
+            case ExtractorMode::VERIFY:
+            {
+                std::string message;
+                bool ok = VerifyRoundTrip( file_path, data, size, message );
+                parallel::Log( ok ? std::cout : std::cerr, message );
+                return ok;
+            }
+            default:
+            {
+                parallel::Log( std::cerr, "Unsupported mode." );
+                return false;
+            }
+        }
+    }
+
+    /// <summary>
+    /// What a journal entry for the mode on this file has to match to count as done. For --import that's the archive and the *_extracted.dds
+    /// that was imported into it, so editing the .dds again after an import isn't skipped by --resume
+    /// </summary>
+    journal::FileStamp JournalStamp(const fs::path& file_path, ExtractorMode extract_mode)
+    {
+        journal::FileStamp stamp = journal::StampOf( file_path );
+        if ( extract_mode != ExtractorMode::IMPORT )
+        {
+            return stamp;
+        }
+
+        journal::FileStamp dds_stamp = journal::StampOf( file_path.parent_path() / ( file_path.stem().string() + "_extracted.dds" ) );
+        stamp.valid = stamp.valid && dds_stamp.valid;
+
+        // Only ever compared for equality, so both stamps are folded into the write time
+        uint64_t combined = static_cast<uint64_t>( stamp.write_time );
+        for ( uint64_t value : { static_cast<uint64_t>( dds_stamp.size ), static_cast<uint64_t>( dds_stamp.write_time ) } )
+        {
+            combined = ( combined ^ value ) * 0x100000001B3ull;
+        }
+        stamp.write_time = static_cast<long long>( combined );
+        return stamp;
+    }
+
+    /// <summary>
+    /// Does the operation that belongs to the extraction mode on a single file
+    /// </summary>
+    void ProcessFile(const fs::path& file_path, ExtractorMode extract_mode, const ProcessOptions& options = {})
+    {
+        if ( ModeReadsOnly( extract_mode ) )
+        {
+            MappedFile file( file_path );
+            if ( !file.IsValid() )
+            {
+                parallel::Log( std::cerr, "Error opening file: " + file_path.string() );
+                return;
+            }
+
+            ProcessBuffer( file_path, file.Data(), file.Size(), extract_mode, options );
+            return;
+        }
+
+        switch ( extract_mode )
+        {
+            case ExtractorMode::IMPORT:
+            {
+                fs::path dds_file_path = file_path.parent_path() / ( file_path.stem().string() + "_extracted.dds" );
+                if ( fs::exists( dds_file_path ) )
+                {
+                    bool ok = ImportDDS( file_path, dds_file_path, options.patch );
+                    if ( options.journal != nullptr )
+                    {
+                        options.journal->Record( file_path, GetModeName( extract_mode ), JournalStamp( file_path, extract_mode ), ok );
+                    }
+                }
+                break;
+            }
+            case ExtractorMode::IMPORT_HASHED:
+            {
+                if ( options.index != nullptr )
+                {
+                    journal::FileStamp stamp = journal::StampOf( file_path );
+                    bool ok = ImportHashedDDS( file_path, *options.index, options.patch );
+                    if ( options.journal != nullptr )
+                    {
+                        options.journal->Record( file_path, GetModeName( extract_mode ), stamp, ok );
+                    }
+                }
+                break;
+            }
+            case ExtractorMode::NMH_FIX_AND_HASH:
+            case ExtractorMode::NMH_FIX_AND_HASH_DDS:
+            {
+                FixAndHashNMHBin( file_path, extract_mode == ExtractorMode::NMH_FIX_AND_HASH_DDS, options.journal );
+                break;
+            }
+            case ExtractorMode::APPLY_PATCH:
+            {
+                journal::FileStamp stamp = journal::StampOf( file_path );
+                std::string message;
+                bool ok = patch::ApplyToFile( file_path, patch::ArchivePathFor( file_path ), message );
+                parallel::Log( ok ? std::cout : std::cerr, message );
+                if ( options.journal != nullptr )
+                {
+                    options.journal->Record( file_path, GetModeName( extract_mode ), stamp, ok );
+                }
+                break;
+            }
+            case ExtractorMode::COMPRESS:
+            {
+                journal::FileStamp stamp = journal::StampOf( file_path );
+                bool ok = CompressTexture( file_path, options );
+                if ( options.journal != nullptr )
+                {
+                    options.journal->Record( file_path, GetModeName( extract_mode ), stamp, ok );
+                }
+                break;
+            }
+            case ExtractorMode::GM2:
+            {
+                // ExtractGCT0FromArchive(file_path);
+                break;
+            }
+            default:
+            {
+                std::cerr << "Unsupported mode." << std::endl;
+                break;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Modes that rename files or create new files with supported extensions, these need the complete file list before they start
+    /// </summary>
+    bool ModeRenamesFiles(ExtractorMode extract_mode)
+    {
+        return extract_mode == ExtractorMode::NMH_FIX_AND_HASH || extract_mode == ExtractorMode::NMH_FIX_AND_HASH_DDS || extract_mode == ExtractorMode::BIG_TO_LITTLE_ENDIAN ||
+               extract_mode == ExtractorMode::COMPRESS;
+    }
+
+    /// <summary>
+    /// Modes where every file is independent and output goes through parallel::Log, so files can be processed in parallel.
+    /// --bintodds writes to the working directory by file name, so two archives with the same name could collide
+    /// </summary>
+    bool ModeRunsInParallel(ExtractorMode extract_mode)
+    {
+        switch ( extract_mode )
+        {
+            case ExtractorMode::EXTRACT:
+            case ExtractorMode::EXTRACT_HASHED:
+            case ExtractorMode::METADATA:
+            case ExtractorMode::VERIFY:
+            case ExtractorMode::BIG_TO_LITTLE_ENDIAN:
+            case ExtractorMode::NMH_FIX_AND_HASH:
+            case ExtractorMode::NMH_FIX_AND_HASH_DDS:
+            case ExtractorMode::APPLY_PATCH:
+            case ExtractorMode::PREVIEW:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool AnyMode(const std::vector<ExtractorMode>& modes, bool (*predicate)(ExtractorMode))
+    {
+        return std::any_of( modes.begin(), modes.end(), predicate );
+    }
+
+    bool AllModes(const std::vector<ExtractorMode>& modes, bool (*predicate)(ExtractorMode))
+    {
+        return std::all_of( modes.begin(), modes.end(), predicate );
+    }
+
+    /// <summary>
+    /// Parses a comma separated mode list like "extract,extracthashed,metadata" (the leading "--" is optional).
+    /// Only read-only modes can be combined, a mode that modifies the archives has to run on its own. Returns an empty list if the list is invalid
+    /// </summary>
+    std::vector<ExtractorMode> GetModesFromList(const std::string& mode_list)
+    {
+        std::vector<ExtractorMode> modes;
+        std::stringstream stream( mode_list );
+        std::string name;
+        while ( std::getline( stream, name, ',' ) )
+        {
+            ExtractorMode extract_mode = GetModeFromString( name.rfind( "--", 0 ) == 0 ? name : "--" + name );
+            if ( extract_mode == ExtractorMode::NONE )
+            {
+                return {};
+            }
+
+            if ( std::find( modes.begin(), modes.end(), extract_mode ) == modes.end() )
+            {
+                modes.push_back( extract_mode );
+            }
+        }
+
+        if ( modes.size() > 1 && !AllModes( modes, ModeReadsOnly ) )
+        {
+            return {};
+        }
+
+        return modes;
+    }
+
+    /// <summary>
+    /// Whether the handler of a mode can do anything with a file of this class. Used by --sniff to skip files without reading them fully.
+    /// </summary>
+    bool ModeAcceptsClass(ExtractorMode extract_mode, classifier::FileClass file_class)
+    {
+        using classifier::FileClass;
+
+        switch ( extract_mode )
+        {
+            case ExtractorMode::EXTRACT:
+            case ExtractorMode::EXTRACT_HASHED:
+            case ExtractorMode::IMPORT:
+            case ExtractorMode::VERIFY:
+                // Archives with DDS data inside, standalone .dds files are what these modes write
+                return file_class == FileClass::K7TX || file_class == FileClass::DDS || file_class == FileClass::JMB || file_class == FileClass::STI;
+            case ExtractorMode::NMH_FIX_AND_HASH:
+            case ExtractorMode::NMH_FIX_AND_HASH_DDS:
+            case ExtractorMode::BIN_TO_DDS:
+                return file_class == FileClass::GCT0 || file_class == FileClass::GCT0_NULL;
+            case ExtractorMode::PREVIEW:
+                return file_class == FileClass::K7TX || file_class == FileClass::DDS || file_class == FileClass::JMB || file_class == FileClass::STI ||
+                       file_class == FileClass::GCT0 || file_class == FileClass::GCT0_NULL;
+            case ExtractorMode::IMPORT_HASHED:
+                return file_class == FileClass::DDS_FILE;
+            case ExtractorMode::APPLY_PATCH:
+                return file_class == FileClass::PATCH;
+            case ExtractorMode::COMPRESS:
+                // TGA has no magic to sniff
+                return file_class == FileClass::DDS_FILE || file_class == FileClass::UNKNOWN;
+            default:
+                return file_class != FileClass::UNKNOWN && file_class != FileClass::DDS_FILE && file_class != FileClass::PATCH;
+        }
+    }
+
+    /// <summary>
+    /// Processes files from the queue until it's closed, in parallel where the modes allow it.
+    /// Read-only modes map each file once and run every requested mode on the same view.
+    /// With --sniff every file is classified from its first bytes first, modes that can't handle it are skipped and the count per class is printed at the end.
+    /// </summary>
+    void ProcessQueue(parallel::WorkQueue<fs::path>& queue, const std::vector<ExtractorMode>& modes, const ProcessOptions& options = {})
+    {
+        unsigned thread_count = AllModes( modes, ModeRunsInParallel ) ? parallel::WorkerCount() : 1;
+        bool reads_only = AllModes( modes, ModeReadsOnly );
+        bool resume = options.resume && options.journal != nullptr;
+
+        std::atomic<size_t> class_counts[static_cast<size_t>( classifier::FileClass::COUNT )] = {};
+        std::atomic<size_t> skipped{ 0 };
+        std::atomic<size_t> resumed{ 0 };
+        std::atomic<size_t> verified{ 0 };
+        std::atomic<size_t> failed{ 0 };
+
+        // A file that is being worked on. RSL members are separate tasks in the same pool as the files, so one big archive is spread over every worker;
+        // the job keeps the archive mapped until its last member is done, and that one records the results
+        struct Job
+        {
+            explicit Job(const fs::path& path) : file_path( path ), file( path ) {}
+
+            fs::path file_path;
+            MappedFile file;
+            journal::FileStamp stamp;
+            std::vector<ExtractorMode> pending_modes;
+            std::vector<rsl::Member> members;
+            std::atomic<size_t> remaining_members{ 0 };
+
+            // Result of every pending mode on this file: -1 didn't run (nothing it can handle), 0 failed, 1 ok
+            std::vector<int> results;
+            std::mutex results_mutex;
+        };
+
+        struct Task
+        {
+            fs::path file_path;             // a file to start on
+            std::shared_ptr<Job> job;       // or a member of an archive that's being worked on
+            size_t member = 0;
+        };
+
+        // Runs the pending modes on a file or an RSL member. Members are always routed by their contents, there's no extension to go by
+        auto run_modes = [&](Job& job, const fs::path& item_path, const u8* data, size_t size, bool by_class)
+        {
+            classifier::FileClass file_class = classifier::FileClass::UNKNOWN;
+            if ( by_class )
+            {
+                file_class = classifier::ClassifyBuffer( data, std::min( size, classifier::SNIFF_SIZE ) );
+                ++class_counts[static_cast<size_t>( file_class )];
+            }
+
+            for ( size_t i = 0; i < job.pending_modes.size(); ++i )
+            {
+                if ( by_class && !ModeAcceptsClass( job.pending_modes[i], file_class ) )
+                {
+                    continue;
+                }
+
+                bool ok = ProcessBuffer( item_path, data, size, job.pending_modes[i], options );
+                if ( job.pending_modes[i] == ExtractorMode::EXTRACT_HASHED && options.index_builder != nullptr )
+                {
+                    IndexTexture( *options.index_builder, job.file_path, static_cast<size_t>( data - job.file.Data() ), data, size );
+                }
+
+                if ( job.pending_modes[i] == ExtractorMode::VERIFY )
+                {
+                    ++verified;
+                    if ( !ok )
+                    {
+                        ++failed;
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock( job.results_mutex );
+                job.results[i] = job.results[i] < 0 ? ok : std::min( job.results[i], static_cast<int>( ok ) );
+            }
+        };
+
+        auto finish = [&](Job& job)
+        {
+            bool handled = false;
+            for ( size_t i = 0; i < job.pending_modes.size(); ++i )
+            {
+                if ( job.results[i] < 0 )
+                {
+                    continue;
+                }
+
+                handled = true;
+                if ( options.journal != nullptr )
+                {
+                    options.journal->Record( job.file_path, GetModeName( job.pending_modes[i] ), job.stamp, job.results[i] > 0 );
+                }
+            }
+
+            if ( !handled )
+            {
+                ++skipped;
+            }
+        };
+
+        // The pool is closed once the input is and every task, including the members they added, is done
+        parallel::WorkQueue<Task> tasks;
+        std::mutex pool_mutex;
+        size_t outstanding = 0;
+        bool input_done = false;
+
+        auto push = [&](Task task)
+        {
+            {
+                std::lock_guard<std::mutex> lock( pool_mutex );
+                ++outstanding;
+            }
+            tasks.Push( std::move( task ) );
+        };
+
+        auto task_done = [&]()
+        {
+            bool close;
+            {
+                std::lock_guard<std::mutex> lock( pool_mutex );
+                close = --outstanding == 0 && input_done;
+            }
+            if ( close )
+            {
+                tasks.Close();
+            }
+        };
+
+        auto start_file = [&](const fs::path& file_path)
+        {
+            journal::FileStamp stamp = journal::StampOf( file_path );
+
+            if ( !reads_only )
+            {
+                // Modes that modify archives always run on their own
+                if ( resume && options.journal->IsDone( file_path, GetModeName( modes.front() ), JournalStamp( file_path, modes.front() ) ) )
+                {
+                    ++resumed;
+                    return;
+                }
+
+                if ( options.sniff )
+                {
+                    classifier::FileClass file_class = classifier::ClassifyFile( file_path );
+                    ++class_counts[static_cast<size_t>( file_class )];
+                    if ( !ModeAcceptsClass( modes.front(), file_class ) )
+                    {
+                        ++skipped;
+                        return;
+                    }
+                }
+
+                ProcessFile( file_path, modes.front(), options );
+                return;
+            }
+
+            std::vector<ExtractorMode> pending_modes;
+            for ( ExtractorMode extract_mode : modes )
+            {
+                if ( !resume || !options.journal->IsDone( file_path, GetModeName( extract_mode ), stamp ) )
+                {
+                    pending_modes.push_back( extract_mode );
+                }
+            }
+
+            if ( pending_modes.empty() )
+            {
+                ++resumed;
+                return;
+            }
+
+            auto job = std::make_shared<Job>( file_path );
+            if ( !job->file.IsValid() )
+            {
+                parallel::Log( std::cerr, "Error opening file: " + file_path.string() );
+                return;
+            }
+
+            job->stamp = stamp;
+            job->pending_modes = std::move( pending_modes );
+            job->results.assign( job->pending_modes.size(), -1 );
+
+            if ( options.index_builder != nullptr && std::find( job->pending_modes.begin(), job->pending_modes.end(), ExtractorMode::EXTRACT_HASHED ) != job->pending_modes.end() )
+            {
+                options.index_builder->ResetArchive( file_path );
+            }
+
+            if ( !rsl::IsArchive( job->file.Data(), job->file.Size() ) )
+            {
+                run_modes( *job, file_path, job->file.Data(), job->file.Size(), options.sniff );
+                finish( *job );
+                return;
+            }
+
+            std::string layout;
+            if ( !rsl::ReadArchive( job->file.Data(), job->file.Size(), job->members, layout ) )
+            {
+                parallel::Log( std::cerr, "Could not read the member table of RSL archive " + file_path.string() + ": " + layout );
+                return;
+            }
+
+            parallel::Log( std::cout, "RSL archive " + file_path.string() + ": " + layout );
+            if ( options.sniff )
+            {
+                ++class_counts[static_cast<size_t>( classifier::FileClass::RSL )];
+            }
+
+            if ( job->members.empty() )
+            {
+                finish( *job );
+                return;
+            }
+
+            job->remaining_members = job->members.size();
+            for ( size_t i = 0; i < job->members.size(); ++i )
+            {
+                push( Task{ fs::path(), job, i } );
+            }
+        };
+
+        auto run_member = [&](Job& job, size_t index)
+        {
+            const rsl::Member& member = job.members[index];
+            try
+            {
+                run_modes( job, rsl::MemberPath( job.file_path, member ), member.data, member.size, true );
+            }
+            catch ( const std::exception& e )
+            {
+                // The other members still have to finish the job
+                parallel::Log( std::cerr, std::string( "Error: " ) + e.what() );
+            }
+
+            if ( --job.remaining_members == 0 )
+            {
+                finish( job );
+            }
+        };
+
+        std::thread feed_thread( [&]()
+        {
+            fs::path file_path;
+            while ( queue.Pop( file_path ) )
+            {
+                push( Task{ file_path, nullptr, 0 } );
+            }
+
+            bool close;
+            {
+                std::lock_guard<std::mutex> lock( pool_mutex );
+                input_done = true;
+                close = outstanding == 0;
+            }
+            if ( close )
+            {
+                tasks.Close();
+            }
+        } );
+
+        parallel::Drain( tasks, thread_count, [&](const Task& task)
+        {
+            try
+            {
+                if ( task.job )
+                {
+                    run_member( *task.job, task.member );
+                }
+                else
+                {
+                    start_file( task.file_path );
+                }
+            }
+            catch ( ... )
+            {
+                task_done();
+                throw;
+            }
+            task_done();
+        } );
+        feed_thread.join();
+
+        if ( options.journal != nullptr )
+        {
+            options.journal->Sync();
+        }
+
+        if ( options.index_builder != nullptr )
+        {
+            if ( options.index_builder->Write() )
+            {
+                std::cout << "Indexed " << options.index_builder->Count() << " texture names, use --lookup <name> to find where one came from." << std::endl;
+            }
+            else
+            {
+                std::cerr << "Error: Could not write the texture index." << std::endl;
+            }
+        }
+
+        if ( options.contact_sheet != nullptr && options.contact_sheet->Count() > 0 )
+        {
+            WriteContactSheet( *options.contact_sheet, options.ppm );
+        }
+
+        if ( resume )
+        {
+            std::cout << "Skipped " << resumed << " files that were already done according to the journal." << std::endl;
+        }
+
+        if ( std::find( modes.begin(), modes.end(), ExtractorMode::VERIFY ) != modes.end() )
+        {
+            std::cout << "Verified " << verified << " files, " << failed << " failed the extract/import round trip." << std::endl;
+        }
+
+        if ( options.sniff )
+        {
+            std::cout << std::endl << "Files by content:" << std::endl;
+            for ( size_t i = 0; i < static_cast<size_t>( classifier::FileClass::COUNT ); ++i )
+            {
+                if ( class_counts[i] > 0 )
+                {
+                    std::cout << "  " << classifier::ToString( static_cast<classifier::FileClass>( i ) ) << ": " << class_counts[i] << std::endl;
+                }
+            }
+            std::cout << "Skipped " << skipped << " files that the selected modes can't handle." << std::endl;
+        }
+    }
+
+    /// <summary>
+    /// Runs the extraction modes over a list of files
+    /// </summary>
+    void ProcessFiles(const std::vector<fs::path>& files, const std::vector<ExtractorMode>& modes, const ProcessOptions& options = {})
+    {
+        parallel::WorkQueue<fs::path> queue;
+        for ( const auto& file_path : files )
+        {
+            queue.Push( file_path );
+        }
+        queue.Close();
+
+        ProcessQueue( queue, modes, options );
+    }
+
+    /// <summary>
+    /// The extensions to walk. With --sniff read-only modes look at every file, whatever its extension. Modes that modify, truncate or rename files
+    /// keep the extension filter, a few bytes that happen to look like a header are not enough to touch a file (sniffing still skips what they can't handle)
+    /// </summary>
+    walker::ExtensionSet WalkExtensions(const walker::ExtensionSet& extensions, const std::vector<ExtractorMode>& modes, const ProcessOptions& options)
+    {
+        return options.sniff && AllModes( modes, ModeReadsOnly ) ? walker::ExtensionSet::Any() : extensions;
+    }
+
+    /// <summary>
+    /// Once the program has been given a directory to work in, from the user, + the extraction modes, this function processes the given files and based on the extraction modes it does the necessary operations (extraction/reimport, etc.)
+    /// The tree is walked once and every file is read once, no matter how many read-only modes were requested.
+    /// Files are handed to the processing stage as soon as the walker finds them, except for modes that rename files, which walk the whole tree first.
+    /// Throws fs::filesystem_error if the directory can't be listed.
+    /// </summary>
+    void ProcessDirectory(const fs::path& directory, const walker::ExtensionSet& extensions, const std::vector<ExtractorMode>& modes, const ProcessOptions& options = {})
+    {
+        walker::ExtensionSet walk_extensions = WalkExtensions( extensions, modes, options );
+
+        if ( AnyMode( modes, ModeRenamesFiles ) )
+        {
+            ProcessFiles( walker::CollectFiles( directory, walk_extensions ), modes, options );
+            return;
+        }
+
+        parallel::WorkQueue<fs::path> queue;
+        std::exception_ptr walk_error;
+        std::thread walk_thread( [&]()
+        {
+            try
+            {
+                walker::Walk( directory, walk_extensions, [&queue](const fs::path& file_path) { queue.Push( file_path ); } );
+            }
+            catch ( const std::exception& )
+            {
+                walk_error = std::current_exception();
+            }
+            queue.Close();
+        } );
+
+        ProcessQueue( queue, modes, options );
+        walk_thread.join();
+        if ( walk_error )
+        {
+            std::rethrow_exception( walk_error );
+        }
+    }
+
+    /// <summary>
+    /// Files the modes write next to their input (st00_le.bin, st00_extracted.dds, st00_metadata.txt...). In watch mode they show up as changes too,
+    /// and --btole's output has an archive extension, so without this it would convert its own output over and over (st00_le_le.bin...)
+    /// </summary>
+    bool IsModeOutput(const fs::path& file_path)
+    {
+        const char* OUTPUT_SUFFIXES[] = { "_le", "_extracted", "_metadata", "_preview" };
+
+        std::string stem = file_path.stem().string();
+        for ( const char* suffix : OUTPUT_SUFFIXES )
+        {
+            size_t length = std::strlen( suffix );
+            if ( stem.size() > length && stem.compare( stem.size() - length, length, suffix ) == 0 )
+            {
+                return true;
+            }
+        }
+
+        return stem.rfind( "contact_sheet_", 0 ) == 0 || stem.rfind( "ddsextractor.", 0 ) == 0;
+    }
+
+    /// <summary>
+    /// Maps a changed file to the archive that has to be processed again, or returns an empty path if the change doesn't matter for this mode.
+    /// For --import that's the archive next to a changed *_extracted.dds, for every other mode it's the changed archive itself, unless a mode wrote it.
+    /// </summary>
+    fs::path GetAffectedArchive(const fs::path& changed_path, const walker::ExtensionSet& extensions, bool importing)
+    {
+        if ( importing )
+        {
+            return changed_path.extension() == ".dds" ? FindExtractedSource( changed_path, extensions ) : fs::path();
+        }
+
+        if ( extensions.Matches( changed_path ) && !IsModeOutput( changed_path ) && fs::is_regular_file( changed_path ) )
+        {
+            return changed_path;
+        }
+
+        return {};
+    }
+
+    /// <summary>
+    /// Processes the whole directory once, then stays resident and only processes the archives affected by files that get created or modified afterwards.
+    /// Changes are debounced: work starts once the tree has been quiet for a moment, and repeated events for the same file are coalesced.
+    /// </summary>
+    void WatchDirectory(const fs::path& directory, const walker::ExtensionSet& extensions, const std::vector<ExtractorMode>& modes, const ProcessOptions& options = {})
+    {
+        bool importing = modes.size() == 1 && modes.front() == ExtractorMode::IMPORT;
+
+        const int DEBOUNCE_MS = 300;
+        const int IDLE_WAIT_MS = 1000;
+
+        watcher::DirectoryWatcher directory_watcher( directory );
+        if ( !directory_watcher.IsValid() )
+        {
+            std::cerr << "Error: Could not watch directory: " << directory << std::endl;
+            return;
+        }
+
+        ProcessDirectory( directory, extensions, modes, options );
+        std::cout << "Watching " << directory << " for changes..." << std::endl;
+
+        std::set<fs::path> pending;
+        // Last write time of every archive we've handled, so the writes done by the tool itself (e.g. --import) don't trigger it again
+        std::map<fs::path, fs::file_time_type> handled;
+        // Last change to an archive that's pending. Changes to anything else don't hold the batch back
+        auto last_relevant_change = std::chrono::steady_clock::now();
+
+        while ( directory_watcher.IsValid() )
+        {
+            int quiet_ms = static_cast<int>( std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - last_relevant_change ).count() );
+            std::vector<fs::path> changed;
+            directory_watcher.WaitForChanges( pending.empty() ? IDLE_WAIT_MS : std::max( 1, DEBOUNCE_MS - quiet_ms ), changed );
+
+            if ( directory_watcher.NeedsRescan() )
+            {
+                std::cout << "Too many changes at once, processing the whole directory again..." << std::endl;
+                pending.clear();
+                ProcessDirectory( directory, extensions, modes, options );
+                continue;
+            }
+
+            for ( const auto& changed_path : changed )
+            {
+                fs::path archive_path = GetAffectedArchive( changed_path, WalkExtensions( extensions, modes, options ), importing );
+                if ( !archive_path.empty() )
+                {
+                    pending.insert( archive_path );
+                    last_relevant_change = std::chrono::steady_clock::now();
+                }
+            }
+
+            // Keep collecting until the pending archives have been quiet for the debounce window
+            if ( pending.empty() || std::chrono::steady_clock::now() - last_relevant_change < std::chrono::milliseconds( DEBOUNCE_MS ) )
+            {
+                continue;
+            }
+
+            std::vector<fs::path> batch;
+            for ( const auto& archive_path : pending )
+            {
+                std::error_code error;
+                fs::file_time_type write_time = fs::last_write_time( archive_path, error );
+                if ( error )
+                {
+                    continue;
+                }
+
+                // For --import the archive itself is the output, so a changed .dds always counts
+                auto handled_it = handled.find( archive_path );
+                if ( !importing && handled_it != handled.end() && handled_it->second == write_time )
+                {
+                    continue;
+                }
+
+                batch.push_back( archive_path );
+            }
+            pending.clear();
+
+            if ( batch.empty() )
+            {
+                continue;
+            }
+
+            std::cout << "Processing " << batch.size() << " changed file(s)..." << std::endl;
+            ProcessFiles( batch, modes, options );
+
+            for ( const auto& archive_path : batch )
+            {
+                std::error_code error;
+                fs::file_time_type write_time = fs::last_write_time( archive_path, error );
+                if ( !error )
+                {
+                    handled[archive_path] = write_time;
+                }
+            }
+        }
+
+        std::cerr << "Error: Lost the watch on directory: " << directory << std::endl;
     }
 }
 
@@ -0,0 +1,357 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include "inc_wrapper.h"
+#include "binary_reader.h"
+#include "mapped_file.h"
+#include "journal.h"
+
+#include <cctype>
+#include <map>
+#include <mutex>
+
+// Reverse index from Replacement names (WIDTHxHEIGHT_hash) to where the texture came from: archive, offset and size of its DDS data.
+// Written by --extracthashed as ddsextractor.index and read with a memory mapping, a lookup is a binary search over the mapped table.
+//
+// File layout (little endian):
+//   0x00  "DXIX"
+//   0x04  u32 version
+//   0x08  u32 entry count
+//   0x0C  u32 archive path count
+//   0x10  u32 offset of the path offset table (u32 per path, into the string data)
+//   0x14  u32 offset of the string data (null-terminated UTF-8 paths, relative to the index)
+//   0x18  reserved
+//   0x20  entries sorted by name, ENTRY_SIZE bytes each: char name[NAME_SIZE] (zero padded), u64 offset, u32 size, u32 path index
+
+namespace hash_index
+{
+    const char INDEX_MAGIC[] = "DXIX";
+    const uint32_t INDEX_VERSION = 1;
+    const size_t HEADER_SIZE = 0x20;
+    const size_t NAME_SIZE = 32;
+    const size_t ENTRY_SIZE = NAME_SIZE + 16;
+    const char INDEX_FILE_NAME[] = "ddsextractor.index";
+
+    /// <summary>
+    /// Where a texture's DDS data lives
+    /// </summary>
+    struct Location
+    {
+        fs::path archive;
+        uint64_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    /// <summary>
+    /// Turns what a user might pass (e.g. "Replacement/0256x0256_deadbeef.dds") into the name that is stored in the index
+    /// </summary>
+    std::string NormalizeName(const std::string& name)
+    {
+        std::string normalized = fs::u8path( name ).stem().u8string();
+        std::transform( normalized.begin(), normalized.end(), normalized.begin(), [](char c) { return static_cast<char>( std::tolower( static_cast<unsigned char>( c ) ) ); } );
+        return normalized;
+    }
+
+    /// <summary>
+    /// Whether a (normalized) name has the WIDTHxHEIGHT_hash shape of hasher::FormatTextureName
+    /// </summary>
+    bool IsTextureName(const std::string& name)
+    {
+        auto all_of_range = [&name](size_t first, size_t last, int (*predicate)(int))
+        {
+            return std::all_of( name.begin() + first, name.begin() + last, [predicate](char c) { return predicate( static_cast<unsigned char>( c ) ) != 0; } );
+        };
+
+        return name.size() > 10 && name.size() < NAME_SIZE && name[4] == 'x' && name[9] == '_' &&
+               all_of_range( 0, 4, isdigit ) && all_of_range( 5, 9, isdigit ) && all_of_range( 10, name.size(), isxdigit );
+    }
+
+    /// <summary>
+    /// Read-only view of an index file
+    /// </summary>
+    class Index
+    {
+    public:
+        explicit Index(const fs::path& index_path)
+            : file( index_path ), root( index_path.parent_path() )
+        {
+            binary::BinaryReader<binary::Endian::Little> reader( file.Data(), file.Size() );
+            if ( !file.IsValid() || !reader.MagicAt( 0, INDEX_MAGIC, 4 ) || reader.Read<uint32_t>( 0x04 ) != INDEX_VERSION )
+            {
+                return;
+            }
+
+            entry_count = reader.Read<uint32_t>( 0x08 );
+            path_count = reader.Read<uint32_t>( 0x0C );
+            path_table_offset = reader.Read<uint32_t>( 0x10 );
+            strings_offset = reader.Read<uint32_t>( 0x14 );
+
+            valid = reader.Has( HEADER_SIZE, entry_count * ENTRY_SIZE ) && reader.Has( path_table_offset, path_count * 4 ) && strings_offset <= file.Size();
+        }
+
+        bool IsValid() const { return valid; }
+        size_t Count() const { return entry_count; }
+
+        /// <summary>
+        /// All the places a texture with this name was found (the same texture can be in several archives)
+        /// </summary>
+        std::vector<Location> Lookup(const std::string& name) const
+        {
+            std::vector<Location> locations;
+
+            std::string key = NormalizeName( name );
+            if ( !valid || key.empty() || key.size() >= NAME_SIZE )
+            {
+                return locations;
+            }
+
+            char padded[NAME_SIZE] = {};
+            std::memcpy( padded, key.data(), key.size() );
+
+            // lower_bound over the mapped entries
+            size_t first = 0;
+            size_t count = entry_count;
+            while ( count > 0 )
+            {
+                size_t step = count / 2;
+                if ( std::memcmp( EntryAt( first + step ), padded, NAME_SIZE ) < 0 )
+                {
+                    first += step + 1;
+                    count -= step + 1;
+                }
+                else
+                {
+                    count = step;
+                }
+            }
+
+            for ( size_t i = first; i < entry_count && std::memcmp( EntryAt( i ), padded, NAME_SIZE ) == 0; ++i )
+            {
+                const u8* entry = EntryAt( i );
+                uint32_t path_index = binary::load<uint32_t, binary::Endian::Little>( entry + NAME_SIZE + 12 );
+
+                Location location;
+                location.archive = root / fs::u8path( PathAt( path_index ) );
+                location.offset = binary::load<uint64_t, binary::Endian::Little>( entry + NAME_SIZE );
+                location.size = binary::load<uint32_t, binary::Endian::Little>( entry + NAME_SIZE + 8 );
+                locations.push_back( location );
+            }
+
+            return locations;
+        }
+
+        /// <summary>
+        /// Calls fn(name, archive path relative to the index, offset, size) for every entry, in name order
+        /// </summary>
+        template <typename Fn>
+        void ForEachEntry(Fn fn) const
+        {
+            for ( size_t i = 0; valid && i < entry_count; ++i )
+            {
+                const u8* entry = EntryAt( i );
+                std::string name( reinterpret_cast<const char*>( entry ), strnlen( reinterpret_cast<const char*>( entry ), NAME_SIZE ) );
+                fn( name, PathAt( binary::load<uint32_t, binary::Endian::Little>( entry + NAME_SIZE + 12 ) ),
+                    binary::load<uint64_t, binary::Endian::Little>( entry + NAME_SIZE ), binary::load<uint32_t, binary::Endian::Little>( entry + NAME_SIZE + 8 ) );
+            }
+        }
+
+    private:
+        const u8* EntryAt(size_t index) const
+        {
+            return file.Data() + HEADER_SIZE + index * ENTRY_SIZE;
+        }
+
+        std::string PathAt(uint32_t path_index) const
+        {
+            if ( path_index >= path_count )
+            {
+                return std::string();
+            }
+
+            size_t string_offset = strings_offset + binary::load<uint32_t, binary::Endian::Little>( file.Data() + path_table_offset + path_index * 4 );
+            if ( string_offset >= file.Size() )
+            {
+                return std::string();
+            }
+
+            const char* path = reinterpret_cast<const char*>( file.Data() + string_offset );
+            return std::string( path, strnlen( path, file.Size() - string_offset ) );
+        }
+
+        MappedFile file;
+        fs::path root;
+        bool valid = false;
+        size_t entry_count = 0;
+        size_t path_count = 0;
+        size_t path_table_offset = 0;
+        size_t strings_offset = 0;
+    };
+
+    /// <summary>
+    /// Collects index entries while files are processed (from any number of threads) and writes the sorted table at the end of a pass.
+    /// Entries are grouped by archive, so an archive that is processed again replaces its old entries instead of adding duplicates.
+    /// </summary>
+    class IndexBuilder
+    {
+    public:
+        /// <summary>
+        /// With keep_existing, the entries of an existing index are loaded first, so archives that --resume skips keep theirs
+        /// </summary>
+        IndexBuilder(const fs::path& index_path, bool keep_existing)
+            : index_path( index_path ), root( index_path.parent_path() )
+        {
+            if ( !keep_existing || !fs::exists( index_path ) )
+            {
+                return;
+            }
+
+            Index existing( index_path );
+            existing.ForEachEntry( [this](const std::string& name, const std::string& archive, uint64_t offset, uint32_t size)
+            {
+                entries[archive].push_back( Entry{ name, offset, size } );
+            } );
+        }
+
+        /// <summary>
+        /// Forgets what was indexed for an archive, called before the archive is processed again
+        /// </summary>
+        void ResetArchive(const fs::path& archive_path)
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            entries.erase( RelativePath( archive_path ) );
+        }
+
+        void Add(const std::string& name, const fs::path& archive_path, uint64_t offset, uint32_t size)
+        {
+            if ( name.empty() || name.size() >= NAME_SIZE )
+            {
+                return;
+            }
+
+            std::string archive = RelativePath( archive_path );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            entries[archive].push_back( Entry{ name, offset, size } );
+        }
+
+        /// <summary>
+        /// Writes the index, replacing the old one in one step
+        /// </summary>
+        bool Write()
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+
+            struct SortedEntry
+            {
+                const Entry* entry;
+                uint32_t path_index;
+            };
+
+            std::vector<SortedEntry> sorted;
+            std::vector<u8> strings;
+            std::vector<uint32_t> path_offsets;
+            for ( const auto& archive : entries )
+            {
+                if ( archive.second.empty() )
+                {
+                    continue;
+                }
+
+                uint32_t path_index = static_cast<uint32_t>( path_offsets.size() );
+                path_offsets.push_back( static_cast<uint32_t>( strings.size() ) );
+                strings.insert( strings.end(), archive.first.begin(), archive.first.end() );
+                strings.push_back( 0 );
+
+                for ( const Entry& entry : archive.second )
+                {
+                    sorted.push_back( SortedEntry{ &entry, path_index } );
+                }
+            }
+
+            std::sort( sorted.begin(), sorted.end(), [](const SortedEntry& a, const SortedEntry& b)
+            {
+                if ( a.entry->name != b.entry->name )
+                {
+                    return a.entry->name < b.entry->name;
+                }
+                return a.path_index != b.path_index ? a.path_index < b.path_index : a.entry->offset < b.entry->offset;
+            } );
+
+            size_t path_table_offset = HEADER_SIZE + sorted.size() * ENTRY_SIZE;
+            size_t strings_offset = path_table_offset + path_offsets.size() * 4;
+
+            std::vector<u8> output;
+            output.reserve( strings_offset + strings.size() );
+
+            output.insert( output.end(), INDEX_MAGIC, INDEX_MAGIC + 4 );
+            Append<uint32_t>( output, INDEX_VERSION );
+            Append<uint32_t>( output, static_cast<uint32_t>( sorted.size() ) );
+            Append<uint32_t>( output, static_cast<uint32_t>( path_offsets.size() ) );
+            Append<uint32_t>( output, static_cast<uint32_t>( path_table_offset ) );
+            Append<uint32_t>( output, static_cast<uint32_t>( strings_offset ) );
+            output.resize( HEADER_SIZE, 0 );
+
+            for ( const SortedEntry& sorted_entry : sorted )
+            {
+                const Entry& entry = *sorted_entry.entry;
+                size_t name_start = output.size();
+                output.insert( output.end(), entry.name.begin(), entry.name.end() );
+                output.resize( name_start + NAME_SIZE, 0 );
+                Append<uint64_t>( output, entry.offset );
+                Append<uint32_t>( output, entry.size );
+                Append<uint32_t>( output, sorted_entry.path_index );
+            }
+
+            for ( uint32_t path_offset : path_offsets )
+            {
+                Append<uint32_t>( output, path_offset );
+            }
+            output.insert( output.end(), strings.begin(), strings.end() );
+
+            return journal::WriteFileDurably( index_path, output.data(), output.size() );
+        }
+
+        size_t Count() const
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+
+            size_t count = 0;
+            for ( const auto& archive : entries )
+            {
+                count += archive.second.size();
+            }
+            return count;
+        }
+
+    private:
+        struct Entry
+        {
+            std::string name;
+            uint64_t offset;
+            uint32_t size;
+        };
+
+        template <typename T>
+        static void Append(std::vector<u8>& output, T value)
+        {
+            for ( size_t i = 0; i < sizeof( T ); ++i )
+            {
+                output.push_back( static_cast<u8>( value >> ( i * 8 ) ) );
+            }
+        }
+
+        std::string RelativePath(const fs::path& archive_path) const
+        {
+            std::error_code error;
+            fs::path relative_path = fs::relative( archive_path, root, error );
+            return ( error || relative_path.empty() ? archive_path : relative_path ).generic_u8string();
+        }
+
+        fs::path index_path;
+        fs::path root;
+        mutable std::mutex mutex;
+        std::map<std::string, std::vector<Entry>> entries;
+    };
+}
+
+#endif
@@ -2,355 +2,533 @@
 #define HASHER_H
 
 #include "inc_wrapper.h"
+#include "binary_reader.h"
+#include "classifier.h"
+
+#include <cctype>
 
 // implementation from: https://web.archive.org/web/20230319040222/https://gist.github.com/SutandoTsukai181/dfe6884ee1254791ab166a0e876dda39
 // credit to SutandoTsukai181
 
 namespace hasher
 {
-    int swapEndian32(char* value)
-    {
-        return ((value[0] & 0xFF) << 24)
-            | ((value[1] & 0xFF) << 16)
-            | ((value[2] & 0xFF) << 8)
-            | (value[3] & 0xFF);
-    }
+    using binary::Endian;
+    using binary::BinaryReader;
 
-    int swapEndian16(char* value)
-    {
-        return ((value[0] & 0xFF) << 8)
-            | (value[1] & 0xFF);
-    }
-
-    int rotateLeft32(uint32_t value, uint8_t count)
+    uint32_t rotateLeft32(uint32_t value, uint8_t count)
     {
         return (value << count) | (value >> (32 - count));
     }
 
     uint32_t DWORDInHexBytesToU32(const char* value)
     {
-        // this is little endian so this might be a problem for fucking sti
-        uint32_t decimal =
-            (value[0]) |   // least significant byte
-            (value[1] << 8) |   // second byte
-            (value[2] << 16) |   // third byte
-            (value[3] << 24);    // most significant byte
-
-        return decimal;
+        return binary::load<uint32_t, Endian::Little>(reinterpret_cast<const u8*>(value));
     }
 
     uint16_t WORDInHexBytesToU16(const char* value)
     {
-        uint16_t decimal =
-            (value[0]) |        // least significant byte
-            (value[1] << 8);    // most significant byte
-
-        return decimal;
+        return binary::load<uint16_t, Endian::Little>(reinterpret_cast<const u8*>(value));
     }
 
-    std::string CalculateHashOriginal(const char* path)
+    /// <summary>
+    /// Result of hashing a texture buffer. gct0/header_valid/k7tx tell which header paths were taken, name is empty when no valid dimensions were found.
+    /// </summary>
+    struct TextureHash
     {
-        std::cout << std::endl << "No More Hashes v1.1 by SutandoTsukai181" << std::endl << std::endl;
+        uint16_t width = 0;
+        uint16_t height = 0;
+        uint32_t hash = 0;
+        bool gct0 = false;
+        bool header_valid = false;
+        bool k7tx = false;
+        std::string name;
+    };
+
+    /// <summary>
+    /// Reads width/height and the texture start from a GCT0 header at header_offset. If the texture start isn't 0x40 the header is treated as invalid and
+    /// start/size are left untouched, otherwise they're moved past the header (and past a K7TX header, if there is one).
+    /// </summary>
+    template <Endian E>
+    void ParseGCT0Header(const BinaryReader<E>& reader, size_t header_offset, TextureHash& result, int& start, int& size)
+    {
+        result.gct0 = true;
 
-        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        // Get width/height to generate full replacement texture name
+        uint16_t width = reader.template Read<uint16_t>(header_offset + 8);
+        uint16_t height = reader.template Read<uint16_t>(header_offset + 10);
 
-        if (!file.is_open())
+        // Try checking for the texture start (should be always 0x40)
+        int32_t texture_start = reader.template Read<int32_t>(header_offset + 0x10);
+        if (texture_start != 0x40)
         {
-            throw std::exception("Error: File could not be opened");
+            return;
         }
 
-        int start = 0;
-        int size = file.tellg();
+        result.header_valid = true;
+        result.width = width;
+        result.height = height;
 
-        char* magic = new char[5];
-        char* int_val = new char[4];
+        // Remove header size from the texture size
+        start = static_cast<int>(header_offset) + texture_start;
+        size -= texture_start;
 
-        uint16_t width = 0;
-        uint16_t height = 0;
+        if (reader.MagicAt(start, "K7TX", 4))
+        {
+            result.k7tx = true;
 
-        file.seekg(0, std::ios::beg);
-        file.read(magic, 4);
-        magic[4] = '\0';
+            // DDS header starts right after K7TX
+            // We're assuming this is always little endian
+            size = reader.template ReadAs<int32_t, Endian::Little>(start + 4);
+            start += 8;
+        }
+    }
 
-        // GCT0 header can either have GCT0 or null as a magic
-        if ((!strcmp(magic, "GCT0") || *magic == 0) && size > 0x40)
-        {
-            std::cout << "Reading GCT0 header...\n";
+    inline uint32_t MixWord(uint32_t hash, uint32_t word)
+    {
+        return (rotateLeft32(hash ^ (rotateLeft32(word * 0xCC9E2D51, 15) * 0x1B873593), 13) + 0xFADDAF14) * 5;
+    }
 
-            bool bigEndian = !strcmp(magic, "GCT0");
+    /// <summary>
+    /// Mixes in the bytes after the last whole word and the size, then applies the final avalanche.
+    /// </summary>
+    uint32_t FinishHash(uint32_t hash, const u8* data, size_t data_size, int start, int size)
+    {
+        BinaryReader<Endian::Little> reader(data, data_size);
+        uint32_t sizeAligned = static_cast<uint32_t>(std::max(size, 0) / 4);
 
-            // Get width/height to generate full replacement texture name
-            file.seekg(8, std::ios::beg);
-            file.read(int_val, 2);
-            width = bigEndian ? swapEndian16(int_val) : *(uint16_t*)int_val;
-            file.read(int_val, 2);
-            height = bigEndian ? swapEndian16(int_val) : *(uint16_t*)int_val;
+        // Mix in the remaining 1-3 bytes, if any. They are sign-extended like the chars the original tool read them into,
+        // changing that would change the hash of every texture with a size that isn't a multiple of 4
+        size_t tail = start + static_cast<size_t>(sizeAligned) * 4;
+        auto extra_at = [&](size_t offset) -> uint32_t { return static_cast<uint32_t>(static_cast<int8_t>(reader.template Read<uint8_t>(tail + offset))); };
+        uint32_t extra_val = 0;
+        switch (size & 3)
+        {
+        case 3:
+            extra_val = extra_at(2) << 16;
+            // Fallthrough
+        case 2:
+            extra_val ^= extra_at(1) << 8;
+            // Fallthrough
+        case 1:
+            extra_val = rotateLeft32((extra_val ^ extra_at(0)) * 0xCC9E2D51, 15) * 0x1B873593;
+            hash ^= extra_val;
+        default:
+            break;
+        }
 
-            // Try checking for the texture start (should be always 0x40)
-            file.seekg(0x10, std::ios::beg);
-            file.read(int_val, 4);
-            start = bigEndian ? swapEndian32(int_val) : *(int*)int_val;
+        hash ^= size;
 
-            if (start != 0x40)
-            {
-                std::cout << "Header is invalid. Hashing the whole file...\n";
+        hash = ((hash >> 16) ^ hash) * 0x85EBCA6B;
+        hash = ((hash >> 13) ^ hash) * 0xC2B2AE35;
+        hash = (hash >> 16) ^ hash;
 
-                // This turned out to be a non valid header - revert back to default values
-                start = 0;
-                width = 0;
-                height = 0;
-            }
-            else
-            {
-                std::cout << "Successfully read the header. Hashing the texture data...\n";
+        return hash;
+    }
 
-                // Remove header size from the texture size
-                size -= start;
+    /// <summary>
+    /// The No More Hashes hash over size bytes starting at start, sampling about 0x40 words read in the given byte order.
+    /// </summary>
+    template <Endian WordEndian>
+    uint32_t HashTextureData(const u8* data, size_t data_size, int start, int size)
+    {
+        BinaryReader<WordEndian> reader(data, data_size);
 
-                file.seekg(start, std::ios::beg);
-                file.read(magic, 4);
-                magic[4] = '\0';
+        uint32_t sizeAligned = static_cast<uint32_t>(std::max(size, 0) / 4);
+        uint32_t chunkSize = std::max(sizeAligned / 0x40, 1u);
 
-                if (!strcmp(magic, "K7TX"))
-                {
-                    std::cout << "Reading K7TX header...\n";
+        // Initial value
+        uint32_t hash = 0xDEADBEEF;
 
-                    // DDS header starts right after K7TX
-                    // We're assuming this is always little endian
-                    start += 8;
-                    file.read((char*)&size, 4);
-                }
-            }
+        // Words that are completely inside the buffer are loaded directly, only a truncated file needs the bounds-checked reads
+        size_t available_words = reader.Has(start, 0) ? (data_size - start) / 4 : 0;
+        uint32_t in_range_words = static_cast<uint32_t>(std::min<size_t>(sizeAligned, available_words));
+        const u8* words = data + std::min<size_t>(start, data_size);
+
+        uint32_t index = 0;
+        for (; index < in_range_words; index += chunkSize)
+        {
+            hash = MixWord(hash, binary::load<uint32_t, WordEndian>(words + static_cast<size_t>(index) * 4));
         }
-        else
+        for (; index < sizeAligned; index += chunkSize)
         {
-            std::cout << "Could not find a GCT0 or K7TX header. Hashing the whole file...\n";
+            hash = MixWord(hash, reader.template Read<uint32_t>(start + static_cast<size_t>(index) * 4));
         }
 
-        std::cout << "\n";
+        return FinishHash(hash, data, data_size, start, size);
+    }
 
-        // Read the texture to a buffer
-        int sizeAligned = size / 4;
-        int chunkSize = std::max(sizeAligned / 0x40, 1);
+    /// <summary>
+    /// Both word orders of HashTextureData in one pass: every sampled word is loaded once and mixed into both hashes.
+    /// </summary>
+    void HashTextureDataBothEndians(const u8* data, size_t data_size, int start, int size, uint32_t& little_hash, uint32_t& big_hash)
+    {
+        BinaryReader<Endian::Little> reader(data, data_size);
 
-        int* buffer = new int[sizeAligned];
-        file.seekg(start, std::ios::beg);
-        file.read((char*)buffer, size);
+        uint32_t sizeAligned = static_cast<uint32_t>(std::max(size, 0) / 4);
+        uint32_t chunkSize = std::max(sizeAligned / 0x40, 1u);
 
-        // Calculate the hash
+        little_hash = 0xDEADBEEF;
+        big_hash = 0xDEADBEEF;
 
-        // Initial value
-        uint32_t hash = 0xDEADBEEF;
+        size_t available_words = reader.Has(start, 0) ? (data_size - start) / 4 : 0;
+        uint32_t in_range_words = static_cast<uint32_t>(std::min<size_t>(sizeAligned, available_words));
+        const u8* words = data + std::min<size_t>(start, data_size);
 
         uint32_t index = 0;
-        while (index < sizeAligned)
+        for (; index < in_range_words; index += chunkSize)
         {
-            hash = (rotateLeft32(hash ^ (rotateLeft32(buffer[index] * 0xCC9E2D51, 15) * 0x1B873593), 13) + 0xFADDAF14) * 5;
-            index += chunkSize;
+            uint32_t word = binary::load<uint32_t, Endian::Little>(words + static_cast<size_t>(index) * 4);
+            little_hash = MixWord(little_hash, word);
+            big_hash = MixWord(big_hash, binary::ByteSwap(word));
         }
-
-        // Read the remaining 1-3 bytes, if any
-        char extra;
-        uint32_t extra_val = 0;
-        switch (size & 3)
+        for (; index < sizeAligned; index += chunkSize)
         {
-        case 3:
-            file.seekg(start + (sizeAligned * 4) + 2, std::ios::beg);
-            file.read(&extra, 1);
-            extra_val = extra << 16;
-            // Fallthrough
-        case 2:
-            file.seekg(start + (sizeAligned * 4) + 1, std::ios::beg);
-            file.read(&extra, 1);
-            extra_val ^= extra << 8;
-            // Fallthrough
-        case 1:
-            file.seekg(start + (sizeAligned * 4), std::ios::beg);
-            file.read(&extra, 1);
-            extra_val = rotateLeft32((extra_val ^ extra) * 0xCC9E2D51, 15) * 0x1B873593;
-            hash ^= extra_val;
-        default:
-            break;
+            uint32_t word = reader.Read<uint32_t>(start + static_cast<size_t>(index) * 4);
+            little_hash = MixWord(little_hash, word);
+            big_hash = MixWord(big_hash, binary::ByteSwap(word));
         }
 
-        hash ^= size;
-
-        hash = ((hash >> 16) ^ hash) * 0x85EBCA6B;
-        hash = ((hash >> 13) ^ hash) * 0xC2B2AE35;
-        hash = (hash >> 16) ^ hash;
+        little_hash = FinishHash(little_hash, data, data_size, start, size);
+        big_hash = FinishHash(big_hash, data, data_size, start, size);
+    }
 
+    std::string FormatTextureName(uint16_t width, uint16_t height, uint32_t hash)
+    {
         if (width > 0 && height > 0 && width < 10000 && height < 10000)
         {
             char name[18 + 1];
             sprintf_s(name, "%04dx%04d_%x", width, height, hash);
-
-            std::cout << "Full texture name: " << name << "\n\n";
             return name;
         }
 
         return {};
     }
 
-    // broken
-    std::string calculateHash(const char* path)
+    /// <summary>
+    /// Finds the part of the buffer that CalculateHashOriginal hashes: after the GCT0 header (and K7TX header) at the start of the file, or the whole file.
+    /// </summary>
+    void LocateTextureData(const u8* data, size_t data_size, TextureHash& result, int& start, int& size)
     {
-        std::ifstream file(path, std::ios::binary | std::ios::ate);
-        if (!file.is_open())
-        {
-            throw std::runtime_error("Error: File could not be opened");
-        }
-
-        int size = file.tellg();
-        char* buffer = new char[size];
-        file.seekg(0, std::ios::beg);
-        file.read(buffer, size);
-
-        int start = 0;
-        int sti_texture_start = 0;
-        uint16_t width = 0;
-        uint16_t height = 0;
-        bool bigEndian = false;
-        bool hasHeader = false;
-        bool sti = false;
+        start = 0;
+        size = static_cast<int>(data_size);
 
-        std::string filePath(path);
-        std::string extension = filePath.substr(filePath.find_last_of('.'));
+        // GCT0 header can either have GCT0 or null as a magic. GCT0 headers are big endian, null ones little endian
+        BinaryReader<Endian::Big> big_endian_reader(data, data_size);
+        BinaryReader<Endian::Little> little_endian_reader(data, data_size);
 
-        if (extension == ".bin" || extension == ".BIN")
-        {
-            // no additional search needed; the code already works for .bin format
-            hasHeader = true;
-            start = 0;
-        }
-        else if (extension == ".jmb" || extension == ".JMB")
+        bool gct0_magic = big_endian_reader.MagicAt(0, "GCT0", 4);
+        if ((gct0_magic || little_endian_reader.Read<uint8_t>(0) == 0) && size > 0x40)
         {
-            for (int i = 0; i < size - 8; ++i)
+            if (gct0_magic)
             {
-                if (std::memcmp(buffer + i, "\x00\x00\x00\x00\x06\x00\x00\x00", 8) == 0)
-                {
-                    std::cout << "Found JMB texture header at position " << i << ".\n";
-                    hasHeader = true;
-                    start = i;
-                    break;
-                }
+                ParseGCT0Header(big_endian_reader, 0, result, start, size);
             }
-        }
-        else if (extension == ".sti" || extension == ".STI")
-        {
-            sti = true;
-            for (int i = 0; i < size - 4; ++i)
+            else
             {
-                if (std::memcmp(buffer + i, "GCT0", 4) == 0)
-                {
-                    std::cout << "Found STI header (GCT0) at position " << i << ".\n";
-                    hasHeader = true;
-                    bigEndian = true;
-                    width = WORDInHexBytesToU16(buffer + i + 8);
-                    height = WORDInHexBytesToU16(buffer + i + 10);
-                    sti_texture_start = *(int*)(buffer + i + 16);
-                    start = i;
-                    break;
-                }
+                ParseGCT0Header(little_endian_reader, 0, result, start, size);
             }
         }
+    }
+
+    /// <summary>
+    /// Same algorithm as CalculateHashOriginal, but works on data that is already in memory and doesn't print anything.
+    /// </summary>
+    TextureHash HashTextureBuffer(const u8* data, size_t data_size)
+    {
+        TextureHash result;
+
+        int start;
+        int size;
+        LocateTextureData(data, data_size, result, start, size);
+
+        // The texture words themselves are always hashed as little endian, like the original tool did on PC
+        result.hash = HashTextureData<Endian::Little>(data, data_size, start, size);
+        result.name = FormatTextureName(result.width, result.height, result.hash);
+
+        return result;
+    }
+
+    std::string CalculateHashOriginal(const char* path)
+    {
+        std::cout << std::endl << "No More Hashes v1.1 by SutandoTsukai181" << std::endl << std::endl;
+
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
 
-        if (hasHeader && size > start + 0x40)
+        if (!file.is_open())
         {
-            if (!sti)
-            {
-                width = bigEndian ? swapEndian16(buffer + start + 8) : *(uint16_t*)(buffer + start + 8);
-                height = bigEndian ? swapEndian16(buffer + start + 10) : *(uint16_t*)(buffer + start + 10);
-            }
+            throw std::exception("Error: File could not be opened");
+        }
 
-            int textureStart = bigEndian ? swapEndian32(buffer + start + 0x10) : *(int*)(buffer + start + 0x10);
-            if (sti)
-            {
-                textureStart = sti_texture_start;
-            }
-            if (textureStart != 0x40)
+        std::vector<u8> buffer(static_cast<size_t>(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+        TextureHash result = HashTextureBuffer(buffer.data(), buffer.size());
+
+        if (result.gct0)
+        {
+            std::cout << "Reading GCT0 header...\n";
+
+            if (!result.header_valid)
             {
                 std::cout << "Header is invalid. Hashing the whole file...\n";
-                start = 0;
-                width = 0;
-                height = 0;
             }
             else
             {
                 std::cout << "Successfully read the header. Hashing the texture data...\n";
-                size -= textureStart;
-                start += textureStart;
 
-                // check for "K7TX" magic byte header at the texture start position
-                if (strncmp(buffer + start, "K7TX", 4) == 0)
+                if (result.k7tx)
                 {
-                    std::cout << "Found K7TX header.\n";
-                    start += 8;
-                    size = bigEndian ? swapEndian16(buffer + start - 4) : *(int*)(buffer + start - 4);
+                    std::cout << "Reading K7TX header...\n";
                 }
             }
         }
         else
         {
-            std::cout << "Could not find a GCT0 or JMB-specific header. Hashing the whole file...\n";
+            std::cout << "Could not find a GCT0 or K7TX header. Hashing the whole file...\n";
         }
 
         std::cout << "\n";
 
-        int sizeAligned = size / 4;
-        int chunkSize = std::max(sizeAligned / 0x40, 1);
-        std::string textureData_string = buffer + start;
-        int* textureData = reinterpret_cast<int*>(buffer + start);
+        if (!result.name.empty())
+        {
+            std::cout << "Full texture name: " << result.name << "\n\n";
+        }
 
-        uint32_t hash = 0xDEADBEEF;
-        uint32_t index = 0;
+        return result.name;
+    }
+
+    /// <summary>
+    /// Which bytes a candidate hash covers
+    /// </summary>
+    enum class Variant
+    {
+        WHOLE_FILE,         // the complete file
+        GCT0_PAYLOAD,       // everything after a 0x40 byte GCT0 header
+        K7TX_TRIMMED        // only the DDS data that a K7TX header after the GCT0 header gives the size of
+    };
+
+    const char* ToString(Variant variant)
+    {
+        switch (variant)
+        {
+        case Variant::WHOLE_FILE: return "whole file";
+        case Variant::GCT0_PAYLOAD: return "GCT0 payload";
+        case Variant::K7TX_TRIMMED: return "K7TX trimmed";
+        default: return "unknown";
+        }
+    }
+
+    /// <summary>
+    /// One name the game's Replacement loader might look a texture up by
+    /// </summary>
+    struct HashCandidate
+    {
+        Variant variant = Variant::WHOLE_FILE;
+        Endian word_endian = Endian::Little;
+        size_t header_offset = 0;   // where the GCT0 header is, JMB/STI files have it further in
+        uint32_t hash = 0;
+        std::string name;
+        bool primary = false;       // the name HashTextureBuffer (and --extracthashed) gives the texture
+    };
+
+    /// <summary>
+    /// Whether a GCT0 header at offset looks real rather than a few matching bytes in texture data: texture start 0x40, the image type
+    /// a small number and both dimensions non-zero and at most MAX_DIMENSION, all read in the header's byte order
+    /// </summary>
+    template <Endian E>
+    bool IsPlausibleHeader(const BinaryReader<E>& reader, size_t offset)
+    {
+        const uint16_t MAX_DIMENSION = 8192;
 
-        while (index < sizeAligned)
+        uint32_t image_type = reader.template Read<uint32_t>(offset + 4);
+        uint16_t width = reader.template Read<uint16_t>(offset + 8);
+        uint16_t height = reader.template Read<uint16_t>(offset + 10);
+        return reader.template Read<int32_t>(offset + 0x10) == 0x40 && image_type <= 0xFF &&
+               width != 0 && height != 0 && width <= MAX_DIMENSION && height <= MAX_DIMENSION;
+    }
+
+    /// <summary>
+    /// Offsets of GCT0 headers that aren't at the start of the file: "GCT0" (STI) and a null magic followed by image type 6 (JMB).
+    /// Only offsets where IsPlausibleHeader holds (in either byte order) are returned. This reads the whole file, so it's only for JMB/STI data (see HasEmbeddedHeaders)
+    /// </summary>
+    std::vector<std::pair<size_t, Endian>> FindEmbeddedHeaders(const u8* data, size_t data_size)
+    {
+        const size_t MAX_HEADERS = 16;
+        const u8 STI_PATTERN[] = { 'G', 'C', 'T', '0' };
+        const u8 JMB_PATTERN[] = { 0x00, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00 };
+
+        std::vector<std::pair<size_t, Endian>> headers;
+        auto scan = [&](const u8* pattern, size_t pattern_size)
         {
-            int currentPos = start + index * 4;
-            if (currentPos >= size) {
-                break;  // Ensure we donft read past the end of the buffer
+            const u8* end = data + data_size;
+            for (const u8* match = std::search(data + 1, end, pattern, pattern + pattern_size); match != end && headers.size() < MAX_HEADERS;
+                 match = std::search(match + 1, end, pattern, pattern + pattern_size))
+            {
+                size_t offset = static_cast<size_t>(match - data);
+                if (data_size <= offset + 0x40)
+                {
+                    break;
+                }
+
+                if (IsPlausibleHeader(BinaryReader<Endian::Big>(data, data_size), offset))
+                {
+                    headers.emplace_back(offset, Endian::Big);
+                }
+                else if (IsPlausibleHeader(BinaryReader<Endian::Little>(data, data_size), offset))
+                {
+                    headers.emplace_back(offset, Endian::Little);
+                }
             }
+        };
 
-            int textureValue = bigEndian
-                ? swapEndian32(buffer + currentPos) // Swap endianness if needed
-                : *(reinterpret_cast<int*>(buffer + currentPos)); // Directly interpret bytes as an int
+        scan(STI_PATTERN, sizeof(STI_PATTERN));
+        scan(JMB_PATTERN, sizeof(JMB_PATTERN));
+        return headers;
+    }
 
-            // Update hash
-            hash = (rotateLeft32(hash ^ (rotateLeft32(textureValue * 0xCC9E2D51, 15) * 0x1B873593), 13) + 0xFADDAF14) * 5;
+    /// <summary>
+    /// Whether data can have GCT0 headers further in: a .jmb/.sti file, or data that classifies as JMB or STI. Other archives keep their texture
+    /// at the start, so they aren't scanned
+    /// </summary>
+    bool HasEmbeddedHeaders(const u8* data, size_t data_size, std::string extension = std::string())
+    {
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (extension == ".jmb" || extension == ".sti")
+        {
+            return true;
+        }
+
+        classifier::FileClass file_class = classifier::ClassifyBuffer(data, std::min(data_size, classifier::SNIFF_SIZE));
+        return file_class == classifier::FileClass::JMB || file_class == classifier::FileClass::STI;
+    }
 
-            // Increment index
-            index += chunkSize;
+    /// <summary>
+    /// Every name the texture might be looked up by: the whole file, the GCT0 payload and the K7TX trimmed data, for the header at the start and for
+    /// headers further in (only if HasEmbeddedHeaders, extension is the file's, if any), each with the words read as little and as big endian. Both byte orders come out of one sampling pass per region,
+    /// so this costs about as much as hashing each region once. If HashTextureBuffer finds a name, it's the first candidate and marked primary. Names are unique.
+    /// </summary>
+    std::vector<HashCandidate> HashVariants(const u8* data, size_t data_size, const std::string& extension = std::string())
+    {
+        struct Region
+        {
+            Variant variant;
+            size_t header_offset;
+            int start;
+            int size;
+            uint16_t width;     // of the header the region belongs to, part of the name
+            uint16_t height;
+        };
+
+        std::vector<Region> regions;
+        auto add_region = [&regions](Variant variant, size_t header_offset, int start, int size, uint16_t width, uint16_t height)
+        {
+            for (const Region& region : regions)
+            {
+                if (region.start == start && region.size == size)
+                {
+                    return;
+                }
+            }
+            regions.push_back(Region{ variant, header_offset, start, size, width, height });
+        };
+
+        // The header at the start decides the primary region and the dimensions of the whole file
+        TextureHash primary;
+        int primary_start;
+        int primary_size;
+        LocateTextureData(data, data_size, primary, primary_start, primary_size);
+
+        uint16_t width = primary.width;
+        uint16_t height = primary.height;
+        add_region(primary.k7tx ? Variant::K7TX_TRIMMED : primary.header_valid ? Variant::GCT0_PAYLOAD : Variant::WHOLE_FILE, 0, primary_start, primary_size, width, height);
+        add_region(Variant::WHOLE_FILE, 0, 0, static_cast<int>(data_size), width, height);
+        if (primary.header_valid)
+        {
+            add_region(Variant::GCT0_PAYLOAD, 0, 0x40, static_cast<int>(data_size) - 0x40, width, height);
         }
 
-        uint32_t extra_val = 0;
-        for (int i = 0; i < (size & 3); ++i)
+        std::vector<std::pair<size_t, Endian>> embedded_headers;
+        if (HasEmbeddedHeaders(data, data_size, extension))
         {
-            extra_val |= buffer[start + (sizeAligned * 4) + i] << (8 * i);
+            embedded_headers = FindEmbeddedHeaders(data, data_size);
         }
-        if (extra_val)
+
+        for (const auto& header : embedded_headers)
         {
-            extra_val = rotateLeft32((extra_val) * 0xCC9E2D51, 15) * 0x1B873593;
-            hash ^= extra_val;
+            TextureHash embedded;
+            int start = 0;
+            int size = static_cast<int>(data_size);
+            if (header.second == Endian::Big)
+            {
+                ParseGCT0Header(BinaryReader<Endian::Big>(data, data_size), header.first, embedded, start, size);
+            }
+            else
+            {
+                ParseGCT0Header(BinaryReader<Endian::Little>(data, data_size), header.first, embedded, start, size);
+            }
+
+            // A file without a header at the start is named after its first embedded texture
+            if (width == 0 || height == 0)
+            {
+                width = embedded.width;
+                height = embedded.height;
+                for (Region& region : regions)
+                {
+                    if (region.header_offset == 0)
+                    {
+                        region.width = width;
+                        region.height = height;
+                    }
+                }
+            }
+
+            // Textures in a JMB/STI can have different sizes, each header names its own regions
+            add_region(Variant::GCT0_PAYLOAD, header.first, static_cast<int>(header.first) + 0x40, static_cast<int>(data_size - header.first) - 0x40, embedded.width, embedded.height);
+            if (embedded.k7tx)
+            {
+                add_region(Variant::K7TX_TRIMMED, header.first, start, size, embedded.width, embedded.height);
+            }
         }
 
-        hash ^= size;
-        hash = ((hash >> 16) ^ hash) * 0x85EBCA6B;
-        hash = ((hash >> 13) ^ hash) * 0xC2B2AE35;
-        hash = (hash >> 16) ^ hash;
+        std::vector<HashCandidate> candidates;
+        auto add_candidate = [&](const Region& region, Endian word_endian, uint32_t hash, bool is_primary)
+        {
+            std::string name = FormatTextureName(region.width, region.height, hash);
+            if (name.empty())
+            {
+                return;
+            }
 
-        // format the final hash as "<width>x<height>_<hash>" for Replacement folder
-        if (width > 0 && height > 0 && width < 10000 && height < 10000)
+            for (const HashCandidate& candidate : candidates)
+            {
+                if (candidate.name == name)
+                {
+                    return;
+                }
+            }
+
+            HashCandidate candidate;
+            candidate.variant = region.variant;
+            candidate.word_endian = word_endian;
+            candidate.header_offset = region.header_offset;
+            candidate.hash = hash;
+            candidate.name = name;
+            candidate.primary = is_primary && primary.header_valid;
+            candidates.push_back(candidate);
+        };
+
+        for (size_t i = 0; i < regions.size(); ++i)
         {
-            char name[18 + 1];
-            sprintf_s(name, "%04dx%04d_%x", width, height, hash);
-            delete[] buffer;
-            return name;
+            uint32_t little_hash;
+            uint32_t big_hash;
+            HashTextureDataBothEndians(data, data_size, regions[i].start, regions[i].size, little_hash, big_hash);
+            add_candidate(regions[i], Endian::Little, little_hash, i == 0);
+            add_candidate(regions[i], Endian::Big, big_hash, false);
         }
 
-        delete[] buffer;
-        return {};
+        return candidates;
     }
-
 }
 
 #endif
@@ -7,9 +7,10 @@
 #include <filesystem>
 #include <string>
 #include <algorithm> 
+#include <cstring>
+#include <cstdint>
 
 #ifdef __GNUC__
-#include <cstring>
 #define sprintf_s(buf, ...) snprintf((buf), sizeof(buf), __VA_ARGS__)
 #endif
 
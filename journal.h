@@ -0,0 +1,349 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "inc_wrapper.h"
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace journal
+{
+    /// <summary>
+    /// Size and last write time of a file, used to tell whether a file is still the one the journal entry was written for
+    /// </summary>
+    struct FileStamp
+    {
+        bool valid = false;
+        unsigned long long size = 0;
+        long long write_time = 0;
+    };
+
+    FileStamp StampOf(const fs::path& file_path)
+    {
+        FileStamp stamp;
+        std::error_code error;
+
+        stamp.size = fs::file_size( file_path, error );
+        if ( error )
+        {
+            return stamp;
+        }
+
+        stamp.write_time = static_cast<long long>( fs::last_write_time( file_path, error ).time_since_epoch().count() );
+        stamp.valid = !error;
+        return stamp;
+    }
+
+    /// <summary>
+    /// Flushes an open file to disk, not just to the OS cache
+    /// </summary>
+#if defined(_WIN32)
+    bool SyncHandle(HANDLE handle)
+    {
+        return FlushFileBuffers( handle ) != 0;
+    }
+#else
+    bool SyncHandle(int fd)
+    {
+        return fsync( fd ) == 0;
+    }
+#endif
+
+    /// <summary>
+    /// Replaces a file so that a crash leaves either the old or the new contents, never a half written file:
+    /// the data goes to "<name>.tmp" next to it, is flushed to disk and then renamed over the target.
+    /// The rename keeps the temporary file's write time, so before_rename gets the stamp the result will have, e.g. to journal it before it becomes visible.
+    /// </summary>
+    bool WriteFileDurably(const fs::path& file_path, const u8* data, size_t size, const std::function<void(const FileStamp&)>& before_rename = nullptr)
+    {
+        fs::path temp_path = file_path;
+        temp_path += ".tmp";
+
+#if defined(_WIN32)
+        HANDLE handle = CreateFileW( temp_path.wstring().c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+        if ( handle == INVALID_HANDLE_VALUE )
+        {
+            return false;
+        }
+
+        bool written = true;
+        size_t offset = 0;
+        while ( written && offset < size )
+        {
+            DWORD chunk = static_cast<DWORD>( std::min<size_t>( size - offset, 1u << 30 ) );
+            DWORD done = 0;
+            written = WriteFile( handle, data + offset, chunk, &done, nullptr ) != 0;
+            offset += done;
+        }
+        written = written && SyncHandle( handle );
+        CloseHandle( handle );
+#else
+        int fd = open( temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+        if ( fd < 0 )
+        {
+            return false;
+        }
+
+        bool written = true;
+        size_t offset = 0;
+        while ( written && offset < size )
+        {
+            ssize_t done = write( fd, data + offset, size - offset );
+            written = done > 0;
+            offset += written ? static_cast<size_t>( done ) : 0;
+        }
+        written = written && SyncHandle( fd );
+        close( fd );
+#endif
+
+        std::error_code error;
+        if ( !written )
+        {
+            fs::remove( temp_path, error );
+            return false;
+        }
+
+        if ( before_rename )
+        {
+            before_rename( StampOf( temp_path ) );
+        }
+
+        fs::rename( temp_path, file_path, error );
+        if ( error )
+        {
+            fs::remove( temp_path, error );
+            return false;
+        }
+
+#if !defined(_WIN32)
+        // The rename itself only survives a crash once the directory entry is on disk too
+        int dir_fd = open( file_path.has_parent_path() ? file_path.parent_path().c_str() : ".", O_RDONLY | O_CLOEXEC );
+        if ( dir_fd >= 0 )
+        {
+            SyncHandle( dir_fd );
+            close( dir_fd );
+        }
+#endif
+        return true;
+    }
+
+    /// <summary>
+    /// Append-only log of the (file, mode, result) combinations that have been completed, so an interrupted run can be resumed with --resume.
+    /// Every entry is one line: result, mode, file size, write time and the absolute path, separated by tabs.
+    /// Entries are flushed to disk in batches; a crash loses at most the last batch (that work is simply done again) and a torn last line is ignored when loading.
+    /// Modes that modify archives call Record with sync_now before they make their change visible, see FixAndHashNMHBin.
+    /// </summary>
+    class Journal
+    {
+    public:
+        static const size_t SYNC_BATCH = 64;
+
+        Journal() = default;
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        ~Journal()
+        {
+            Close();
+        }
+
+        /// <summary>
+        /// Opens the journal for appending. With resume the existing entries are loaded first. Without, they're ignored but kept in the file,
+        /// so a run of another mode doesn't throw away what an interrupted one needs to continue (later entries for the same file win)
+        /// </summary>
+        bool Open(const fs::path& journal_path, bool resume)
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+
+            if ( resume )
+            {
+                Load( journal_path );
+            }
+
+#if defined(_WIN32)
+            handle = CreateFileW( journal_path.wstring().c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+            return handle != INVALID_HANDLE_VALUE;
+#else
+            fd = open( journal_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644 );
+            return fd >= 0;
+#endif
+        }
+
+        bool IsOpen() const
+        {
+#if defined(_WIN32)
+            return handle != INVALID_HANDLE_VALUE;
+#else
+            return fd >= 0;
+#endif
+        }
+
+        /// <summary>
+        /// Whether the mode already completed on this file and the file hasn't changed since. Failed entries are tried again
+        /// </summary>
+        bool IsDone(const fs::path& file_path, const std::string& mode, const FileStamp& stamp) const
+        {
+            if ( !stamp.valid )
+            {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock( mutex );
+
+            auto it = completed.find( Key( file_path, mode ) );
+            return it != completed.end() && it->second.ok && it->second.stamp.size == stamp.size && it->second.stamp.write_time == stamp.write_time;
+        }
+
+        void Record(const fs::path& file_path, const std::string& mode, const FileStamp& stamp, bool ok, bool sync_now = false)
+        {
+            if ( !stamp.valid )
+            {
+                return;
+            }
+
+            std::string key = Key( file_path, mode );
+            std::string line = std::string( ok ? "ok" : "failed" ) + '\t' + mode + '\t' + std::to_string( stamp.size ) + '\t' + std::to_string( stamp.write_time ) + '\t' + key.substr( mode.size() + 1 ) + '\n';
+
+            std::lock_guard<std::mutex> lock( mutex );
+
+            completed[key] = Entry{ ok, stamp };
+            if ( !IsOpen() )
+            {
+                return;
+            }
+
+            // One write per line, so lines from different threads never interleave
+#if defined(_WIN32)
+            DWORD done = 0;
+            WriteFile( handle, line.data(), static_cast<DWORD>( line.size() ), &done, nullptr );
+#else
+            ssize_t done = write( fd, line.data(), line.size() );
+            (void)done;
+#endif
+
+            ++unsynced;
+            if ( sync_now || unsynced >= SYNC_BATCH )
+            {
+                SyncLocked();
+            }
+        }
+
+        void Sync()
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            SyncLocked();
+        }
+
+        void Close()
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if ( !IsOpen() )
+            {
+                return;
+            }
+
+            SyncLocked();
+#if defined(_WIN32)
+            CloseHandle( handle );
+            handle = INVALID_HANDLE_VALUE;
+#else
+            close( fd );
+            fd = -1;
+#endif
+        }
+
+    private:
+        struct Entry
+        {
+            bool ok = false;
+            FileStamp stamp;
+        };
+
+        static std::string Key(const fs::path& file_path, const std::string& mode)
+        {
+            std::error_code error;
+            fs::path absolute_path = fs::absolute( file_path, error );
+            return mode + '\t' + ( error ? file_path : absolute_path ).lexically_normal().u8string();
+        }
+
+        void Load(const fs::path& journal_path)
+        {
+            std::ifstream file( journal_path, std::ios::binary );
+            std::string contents( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
+
+            size_t line_start = 0;
+            size_t line_end;
+            while ( ( line_end = contents.find( '\n', line_start ) ) != std::string::npos )
+            {
+                std::vector<std::string> fields;
+                std::stringstream line( contents.substr( line_start, line_end - line_start ) );
+                std::string field;
+                while ( fields.size() < 4 && std::getline( line, field, '\t' ) )
+                {
+                    fields.push_back( field );
+                }
+                std::getline( line, field );
+                line_start = line_end + 1;
+
+                if ( fields.size() != 4 || field.empty() )
+                {
+                    continue;
+                }
+
+                Entry entry;
+                entry.ok = fields[0] == "ok";
+                try
+                {
+                    entry.stamp.size = std::stoull( fields[2] );
+                    entry.stamp.write_time = std::stoll( fields[3] );
+                }
+                catch ( const std::exception& )
+                {
+                    continue;
+                }
+                entry.stamp.valid = true;
+
+                completed[fields[1] + '\t' + field] = entry;
+            }
+        }
+
+        void SyncLocked()
+        {
+            if ( IsOpen() && unsynced > 0 )
+            {
+#if defined(_WIN32)
+                SyncHandle( handle );
+#else
+                SyncHandle( fd );
+#endif
+            }
+            unsynced = 0;
+        }
+
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> completed;
+        size_t unsynced = 0;
+
+#if defined(_WIN32)
+        HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+        int fd = -1;
+#endif
+    };
+}
+
+#endif
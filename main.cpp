@@ -3,15 +3,13 @@
 #include <vector>
 #include <filesystem>
 #include <string>
+#include <chrono>
+#include <memory>
 
 #include "extractorimpl.h"
 
 namespace fs = std::filesystem;
 
-// TODO: add --metadata mode functionality
-// TODO: add RSL support
-// TODO: add --compress mode (if possible)
-
 int main(int argc, char* argv[])
 {
     std::string mode;
@@ -20,28 +18,226 @@ int main(int argc, char* argv[])
     std::cout << std::endl << std::endl << std::endl << std::endl; // im.. sorry
     std::cout << "DDSExtractor" << std::endl;
     std::cout << "------------" << std::endl;
-    std::cout << "Supported file extensions: .bin, .dat, .sti, .jmb" << std::endl;
-    std::cout << "In order to get access to such files, please use: https://github.com/Timo654/No-More-RSL" << std::endl;
+    std::cout << "Supported file extensions: .bin, .dat, .sti, .jmb, .rsl" << std::endl;
     std::cout << std::endl;
 
+    // --lookup <name> <path>: where did this Replacement texture come from
+    if ( argc >= 2 && std::string( argv[1] ) == "--lookup" )
+    {
+        if ( argc < 4 )
+        {
+            std::cerr << "Usage: --lookup <WIDTHxHEIGHT_hash> <path that --extracthashed was run on>" << std::endl;
+            return 1;
+        }
+
+        hash_index::Index index( fs::path( argv[3] ) / hash_index::INDEX_FILE_NAME );
+        if ( !index.IsValid() )
+        {
+            std::cerr << "Error: No texture index in " << argv[3] << ", run --extracthashed on it first" << std::endl;
+            return 1;
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        std::vector<hash_index::Location> locations = index.Lookup( argv[2] );
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start_time );
+
+        for ( const auto& location : locations )
+        {
+            std::cout << location.archive.string() << " offset " << location.offset << " size " << location.size << std::endl;
+        }
+        std::cout << locations.size() << " location(s) found among " << index.Count() << " indexed textures in " << elapsed.count() << " us" << std::endl;
+        return locations.empty() ? 1 : 0;
+    }
+
+    // --hashes <file>: every Replacement name the texture might be looked up by
+    if ( argc >= 2 && std::string( argv[1] ) == "--hashes" )
+    {
+        if ( argc < 3 )
+        {
+            std::cerr << "Usage: --hashes <file>" << std::endl;
+            return 1;
+        }
+
+        MappedFile file( argv[2] );
+        if ( !file.IsValid() )
+        {
+            std::cerr << "Error opening file: " << argv[2] << std::endl;
+            return 1;
+        }
+
+        std::vector<hasher::HashCandidate> candidates = hasher::HashVariants( file.Data(), file.Size(), fs::path( argv[2] ).extension().string() );
+        for ( const auto& candidate : candidates )
+        {
+            std::cout << DDSExtractor::FormatHashCandidate( candidate ) << ( candidate.primary ? " <- --extracthashed" : "" ) << std::endl;
+        }
+        std::cout << candidates.size() << " candidate name(s)" << std::endl;
+        return candidates.empty() ? 1 : 0;
+    }
+
+    // --diff <old> <new>: which textures differ between two trees, without extracting anything
+    if ( argc >= 2 && std::string( argv[1] ) == "--diff" )
+    {
+        if ( argc < 4 )
+        {
+            std::cerr << "Usage: --diff <old folder> <new folder>" << std::endl;
+            return 1;
+        }
+
+        if ( !fs::is_directory( argv[2] ) || !fs::is_directory( argv[3] ) )
+        {
+            std::cerr << "Error: Not a directory: " << ( fs::is_directory( argv[2] ) ? argv[3] : argv[2] ) << std::endl;
+            return 1;
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        size_t differences = 0;
+        try
+        {
+            differences = DDSExtractor::DiffTrees( argv[2], argv[3] );
+        }
+        catch ( const fs::filesystem_error& e )
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start_time );
+        std::cout << "Compared in " << elapsed.count() << " ms" << std::endl;
+        return differences == 0 ? 0 : 1;
+    }
+
+    // --stage <source> <Replacement folder> [--dryrun]: link the hashed textures into the game's Replacement folder and drop the ones staged earlier that are gone
+    if ( argc >= 2 && std::string( argv[1] ) == "--stage" )
+    {
+        if ( argc < 4 )
+        {
+            std::cerr << "Usage: --stage <path that --extracthashed was run on> <Replacement folder> [--dryrun]" << std::endl;
+            return 1;
+        }
+
+        bool dry_run = argc >= 5 && std::string( argv[4] ) == "--dryrun";
+        std::error_code error;
+        if ( !dry_run )
+        {
+            fs::create_directories( argv[3], error );
+        }
+        if ( !fs::is_directory( argv[2] ) || ( !dry_run && !fs::is_directory( argv[3] ) ) )
+        {
+            std::cerr << "Error: Not a directory: " << ( fs::is_directory( argv[2] ) ? argv[3] : argv[2] ) << std::endl;
+            return 1;
+        }
+
+        auto start_time = std::chrono::steady_clock::now();
+        staging::Result result;
+        staging::Stage( argv[2], argv[3], dry_run, result );
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start_time );
+
+        if ( dry_run )
+        {
+            std::cout << "Dry run, nothing was changed: " << result.added << " would be added, " << result.updated << " updated, " << result.pruned << " removed; ";
+        }
+        else
+        {
+            std::cout << result.added << " added, " << result.updated << " updated (" << result.hardlinked << " hardlinked, " << result.reflinked << " reflinked, " << result.copied << " copied), "
+                      << result.pruned << " removed; ";
+        }
+        std::cout << result.identical << " already up to date, " << result.kept << " kept because --stage didn't put them there, " << result.failed << " failed in " << elapsed.count() << " ms" << std::endl;
+
+        if ( result.duplicates > 0 )
+        {
+            std::cout << result.duplicates << " texture(s) found more than once in " << argv[2] << ", the first one of each was used" << std::endl;
+        }
+        return result.failed == 0 ? 0 : 1;
+    }
+
+    // --pixeldiff <original> <replacement> [diff.tga]: how close a replacement is to the texture it replaces
+    if ( argc >= 2 && std::string( argv[1] ) == "--pixeldiff" )
+    {
+        if ( argc < 4 )
+        {
+            std::cerr << "Usage: --pixeldiff <original> <replacement> [difference image .tga/.ppm] (.dds, .tga, or an archive with a texture in it)" << std::endl;
+            return 1;
+        }
+
+        texture::Image original;
+        texture::Image replacement;
+        if ( !DDSExtractor::LoadImageFile( argv[2], original ) || !DDSExtractor::LoadImageFile( argv[3], replacement ) )
+        {
+            std::cerr << "Error: Could not decode " << ( original.Empty() ? argv[2] : argv[3] ) << std::endl;
+            return 1;
+        }
+
+        if ( original.width != replacement.width || original.height != replacement.height )
+        {
+            std::cout << "Sizes differ (" << original.width << "x" << original.height << " vs " << replacement.width << "x" << replacement.height << "), comparing the replacement scaled to the original's size" << std::endl;
+            replacement = texture::Resize( replacement, original.width, original.height );
+        }
+
+        texture::DiffStats stats = texture::Compare( original, replacement );
+        std::cout << "PSNR (RGB): " << stats.psnr_rgb << " dB" << std::endl;
+        std::cout << "PSNR (alpha): " << stats.psnr_alpha << " dB" << std::endl;
+        std::cout << "Max channel difference: " << stats.max_error << std::endl;
+        std::cout << "Differing pixels: " << stats.differing_pixels << " of " << static_cast<size_t>( original.width ) * original.height << std::endl;
+
+        if ( argc >= 5 )
+        {
+            fs::path diff_path = argv[4];
+            texture::Image diff = texture::DiffImage( original, replacement );
+            std::vector<u8> encoded = diff_path.extension() == ".ppm" ? texture::EncodePPM( diff ) : texture::EncodeTGA( diff );
+            if ( !DDSExtractor::WriteBufferToFile( diff_path, encoded.data(), encoded.size() ) )
+            {
+                std::cerr << "Error: Could not save file: " << diff_path.string() << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    int next_arg = 2;
     if ( argc < 2 )
     {
-        std::cout << "Please specify the mode that the tool should run in (--extract --extracthashed --import --nmhfixandhash or --bintodds): ";
+        std::cout << "Please specify the mode that the tool should run in (--extract --extracthashed --import --importhashed --applypatch --compress --preview --metadata --nmhfixandhash --nmhfixandhashdds, --bintodds or --verify): ";
         std::getline( std::cin, mode );
     }
+    else if ( std::string( argv[1] ) == "--mode" )
+    {
+        if ( argc < 3 )
+        {
+            std::cerr << "--mode needs a comma separated list of modes, e.g. --mode extract,extracthashed,metadata" << std::endl;
+            return 1;
+        }
+
+        mode = argv[2];
+        next_arg = 3;
+    }
     else
     {
         mode = argv[1];
     }
 
-    if ( mode != "--extract" && mode != "--extracthashed" && mode != "--import" && mode != "--nmhfixandhash" && mode != "--btole" && mode != "--extractarchive" && mode != "--gm2" && mode != "--bintodds")
+    // Either a single mode flag or a list of modes that all run in the same pass over the files
+    std::vector<ExtractorMode> modes;
+    if ( mode.rfind( "--", 0 ) == 0 && mode.find( ',' ) == std::string::npos )
+    {
+        ExtractorMode extractor_mode_flag = DDSExtractor::GetModeFromString( mode );
+        if ( extractor_mode_flag != ExtractorMode::NONE )
+        {
+            modes.push_back( extractor_mode_flag );
+        }
+    }
+    else
+    {
+        modes = DDSExtractor::GetModesFromList( mode );
+    }
+
+    if ( modes.empty() )
     {
         std::cerr << "Invalid mode: " << mode << std::endl;
-        std::cerr << "Mode flag should be either --extract to extract DDS files, or --import to re-import DDS files" << std::endl;
+        std::cerr << "Mode flag should be one of --extract, --extracthashed, --import, --importhashed, --applypatch, --compress, --preview, --metadata, --nmhfixandhash, --nmhfixandhashdds, --btole, --gm2, --bintodds or --verify" << std::endl;
+        std::cerr << "Read-only modes can be combined with --mode, e.g. --mode extract,extracthashed,metadata" << std::endl;
         return 1;
     }
 
-    if ( argc < 3 )
+    if ( argc <= next_arg )
     {
         std::cout << "Please specify the path you want the tool to work in: ";
         std::string input_dir;
@@ -50,20 +246,152 @@ int main(int argc, char* argv[])
     }
     else
     {
-        directory = argv[2];
+        directory = argv[next_arg];
     }
 
-    ExtractorMode extractor_mode_flag = DDSExtractor::GetModeFromString( mode );
-    if ( extractor_mode_flag == ExtractorMode::NONE ) 
+    bool watch = false;
+    bool contact_sheet = false;
+    ProcessOptions options;
+    for ( int i = next_arg + 1; i < argc; ++i )
     {
-        std::cerr << "Invalid mode: " << mode << std::endl;
-        std::cerr << "Mode flag should be one of --extract, --extracthashed, --import, --nmhfixandhash or --bintodds" << std::endl;
+        std::string option = argv[i];
+        if ( option == "--watch" )
+        {
+            watch = true;
+        }
+        else if ( option == "--sniff" )
+        {
+            options.sniff = true;
+        }
+        else if ( option == "--resume" )
+        {
+            options.resume = true;
+        }
+        else if ( option == "--patch" )
+        {
+            options.patch = true;
+        }
+        else if ( option == "--ppm" )
+        {
+            options.ppm = true;
+        }
+        else if ( option == "--contactsheet" )
+        {
+            contact_sheet = true;
+        }
+        else if ( option == "--quality" && i + 1 < argc )
+        {
+            if ( !bc::GetQualityFromString( argv[++i], options.quality ) )
+            {
+                std::cerr << "--quality should be fast, normal or high" << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return 1;
+        }
+    }
+
+    if ( options.patch && modes.front() != ExtractorMode::IMPORT && modes.front() != ExtractorMode::IMPORT_HASHED )
+    {
+        std::cerr << "--patch only works with --import and --importhashed" << std::endl;
         return 1;
     }
 
-    std::vector<std::string> extensions = { ".bin", ".BIN", ".dat", ".DAT", ".sti", ".STI", ".jmb", ".JMB", ".GM2" };
+    bool previewing = std::find( modes.begin(), modes.end(), ExtractorMode::PREVIEW ) != modes.end();
+    if ( ( options.ppm || contact_sheet ) && !previewing )
+    {
+        std::cerr << "--ppm and --contactsheet only work with --preview" << std::endl;
+        return 1;
+    }
 
-    DDSExtractor::ProcessDirectory( directory, extensions, extractor_mode_flag );
+    // Modes that modify files always journal their work, so an interrupted run can be continued with --resume. Read-only modes leave the folder alone
+    // unless --resume was given
+    journal::Journal run_journal;
+    if ( !DDSExtractor::AllModes( modes, DDSExtractor::ModeReadsOnly ) || options.resume )
+    {
+        if ( run_journal.Open( directory / "ddsextractor.journal", options.resume ) )
+        {
+            options.journal = &run_journal;
+        }
+        else
+        {
+            std::cerr << "Warning: Could not open the journal in " << directory << ", --resume won't be able to continue this run" << std::endl;
+        }
+    }
+
+    walker::ExtensionSet extensions = DDSExtractor::ArchiveExtensions();
+
+    // RSL archives are read in place, modes that modify files only work on unpacked ones
+    if ( DDSExtractor::AllModes( modes, DDSExtractor::ModeReadsOnly ) )
+    {
+        extensions.Add( ".rsl" );
+    }
+
+    // --extracthashed keeps the reverse index up to date, --importhashed uses it to find where textures go
+    bool hashing = std::find( modes.begin(), modes.end(), ExtractorMode::EXTRACT_HASHED ) != modes.end();
+    std::unique_ptr<hash_index::IndexBuilder> index_builder;
+    if ( hashing )
+    {
+        index_builder = std::make_unique<hash_index::IndexBuilder>( directory / hash_index::INDEX_FILE_NAME, options.resume );
+        options.index_builder = index_builder.get();
+    }
+
+    std::unique_ptr<texture::ContactSheet> sheet;
+    if ( contact_sheet )
+    {
+        sheet = std::make_unique<texture::ContactSheet>( directory / "contact_sheet" );
+        options.contact_sheet = sheet.get();
+    }
+
+    std::unique_ptr<hash_index::Index> index;
+    if ( modes.front() == ExtractorMode::COMPRESS )
+    {
+        // The inputs are the edited textures. The index is optional here, it only tells Replacement textures what they replace
+        extensions = { ".tga", ".dds" };
+        if ( fs::exists( directory / hash_index::INDEX_FILE_NAME ) )
+        {
+            index = std::make_unique<hash_index::Index>( directory / hash_index::INDEX_FILE_NAME );
+            options.index = index->IsValid() ? index.get() : nullptr;
+        }
+    }
+    else if ( modes.front() == ExtractorMode::IMPORT_HASHED )
+    {
+        index = std::make_unique<hash_index::Index>( directory / hash_index::INDEX_FILE_NAME );
+        if ( !index->IsValid() )
+        {
+            std::cerr << "Error: No texture index in " << directory << ", run --extracthashed on it first" << std::endl;
+            return 1;
+        }
+        options.index = index.get();
+
+        // The inputs are the Replacement named .dds files, not the archives
+        extensions = { ".dds" };
+    }
+
+    if ( modes.front() == ExtractorMode::APPLY_PATCH )
+    {
+        extensions = { patch::PATCH_EXTENSION };
+    }
+
+    try
+    {
+        if ( watch )
+        {
+            DDSExtractor::WatchDirectory( directory, extensions, modes, options );
+        }
+        else
+        {
+            DDSExtractor::ProcessDirectory( directory, extensions, modes, options );
+        }
+    }
+    catch ( const fs::filesystem_error& e )
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
 
     return 0;
 }
\ No newline at end of file
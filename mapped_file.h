@@ -0,0 +1,131 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "inc_wrapper.h"
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+/// <summary>
+/// Read-only memory mapping of a whole file, so every handler that runs on a file can share one view of it instead of reading it again.
+/// Empty files are valid and have a null Data().
+/// </summary>
+class MappedFile
+{
+public:
+    explicit MappedFile(const fs::path& file_path)
+    {
+#if defined(_WIN32)
+        file_handle = CreateFileW( file_path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+        if ( file_handle == INVALID_HANDLE_VALUE )
+        {
+            return;
+        }
+
+        LARGE_INTEGER file_size;
+        if ( !GetFileSizeEx( file_handle, &file_size ) )
+        {
+            return;
+        }
+
+        size = static_cast<size_t>( file_size.QuadPart );
+        if ( size > 0 )
+        {
+            mapping_handle = CreateFileMappingW( file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+            if ( mapping_handle == nullptr )
+            {
+                return;
+            }
+
+            data = static_cast<const u8*>( MapViewOfFile( mapping_handle, FILE_MAP_READ, 0, 0, 0 ) );
+            if ( data == nullptr )
+            {
+                return;
+            }
+        }
+#else
+        int fd = open( file_path.c_str(), O_RDONLY | O_CLOEXEC );
+        if ( fd < 0 )
+        {
+            return;
+        }
+
+        struct stat info;
+        if ( fstat( fd, &info ) != 0 )
+        {
+            close( fd );
+            return;
+        }
+
+        size = static_cast<size_t>( info.st_size );
+        if ( size > 0 )
+        {
+            void* view = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if ( view == MAP_FAILED )
+            {
+                close( fd );
+                return;
+            }
+
+            data = static_cast<const u8*>( view );
+            madvise( view, size, MADV_SEQUENTIAL );
+        }
+        close( fd );
+#endif
+        valid = true;
+    }
+
+    ~MappedFile()
+    {
+#if defined(_WIN32)
+        if ( data != nullptr )
+        {
+            UnmapViewOfFile( data );
+        }
+        if ( mapping_handle != nullptr )
+        {
+            CloseHandle( mapping_handle );
+        }
+        if ( file_handle != INVALID_HANDLE_VALUE )
+        {
+            CloseHandle( file_handle );
+        }
+#else
+        if ( data != nullptr )
+        {
+            munmap( const_cast<u8*>( data ), size );
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool IsValid() const { return valid; }
+    const u8* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const u8* data = nullptr;
+    size_t size = 0;
+    bool valid = false;
+
+#if defined(_WIN32)
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "inc_wrapper.h"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+
+namespace parallel
+{
+    /// <summary>
+    /// Number of worker threads to use for per-file work
+    /// </summary>
+    unsigned WorkerCount()
+    {
+        unsigned count = std::thread::hardware_concurrency();
+        return count > 0 ? count : 4;
+    }
+
+    /// <summary>
+    /// Lock shared by everything that prints from worker threads, so lines from different files don't interleave
+    /// </summary>
+    std::mutex& ConsoleMutex()
+    {
+        static std::mutex console_mutex;
+        return console_mutex;
+    }
+
+    void Log(std::ostream& stream, const std::string& line)
+    {
+        std::lock_guard<std::mutex> lock( ConsoleMutex() );
+        stream << line << std::endl;
+    }
+
+    /// <summary>
+    /// Gets an exception that escaped the work function for one item; the other items are still processed. It runs inside the catch block,
+    /// so std::current_exception() can keep it. Called from the worker threads
+    /// </summary>
+    using ErrorHandler = std::function<void(const std::exception&)>;
+
+    /// <summary>
+    /// Default ErrorHandler of the tool: prints the error. The library passes its own, it must not print
+    /// </summary>
+    void LogError(const std::exception& e)
+    {
+        Log( std::cerr, std::string( "Error: " ) + e.what() );
+    }
+
+    /// <summary>
+    /// Runs fn on every item, spread across WorkerCount() threads. Items are handed out one at a time so a few big files don't stall a whole thread's share.
+    /// </summary>
+    template <typename T, typename Fn>
+    void ForEach(const std::vector<T>& items, Fn fn, unsigned max_threads = 0, const ErrorHandler& on_error = LogError)
+    {
+        std::atomic<size_t> next_index{ 0 };
+
+        auto worker = [&]()
+        {
+            for ( size_t i = next_index++; i < items.size(); i = next_index++ )
+            {
+                try
+                {
+                    fn( items[i] );
+                }
+                catch ( const std::exception& e )
+                {
+                    on_error( e );
+                }
+            }
+        };
+
+        unsigned thread_count = static_cast<unsigned>( std::min<size_t>( max_threads > 0 ? max_threads : WorkerCount(), items.size() ) );
+        if ( thread_count <= 1 )
+        {
+            worker();
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        for ( unsigned i = 0; i < thread_count; ++i )
+        {
+            threads.emplace_back( worker );
+        }
+
+        for ( auto& thread : threads )
+        {
+            thread.join();
+        }
+    }
+
+    /// <summary>
+    /// Unbounded multi-producer/multi-consumer queue. Producers call Close() when they're done, Pop() returns false once the queue is closed and empty.
+    /// </summary>
+    template <typename T>
+    class WorkQueue
+    {
+    public:
+        void Push(T item)
+        {
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                items.push_back( std::move( item ) );
+            }
+            ready.notify_one();
+        }
+
+        void Close()
+        {
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                closed = true;
+            }
+            ready.notify_all();
+        }
+
+        bool Pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            ready.wait( lock, [this]() { return closed || !items.empty(); } );
+            if ( items.empty() )
+            {
+                return false;
+            }
+
+            item = std::move( items.front() );
+            items.pop_front();
+            return true;
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<T> items;
+        bool closed = false;
+    };
+
+    /// <summary>
+    /// Consumes a WorkQueue with thread_count threads until it's closed and empty
+    /// </summary>
+    template <typename T, typename Fn>
+    void Drain(WorkQueue<T>& queue, unsigned thread_count, Fn fn, const ErrorHandler& on_error = LogError)
+    {
+        auto worker = [&]()
+        {
+            T item;
+            while ( queue.Pop( item ) )
+            {
+                try
+                {
+                    fn( item );
+                }
+                catch ( const std::exception& e )
+                {
+                    on_error( e );
+                }
+            }
+        };
+
+        if ( thread_count <= 1 )
+        {
+            worker();
+            return;
+        }
+
+        std::vector<std::thread> threads;
+        for ( unsigned i = 0; i < thread_count; ++i )
+        {
+            threads.emplace_back( worker );
+        }
+
+        for ( auto& thread : threads )
+        {
+            thread.join();
+        }
+    }
+}
+
+#endif
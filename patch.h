@@ -0,0 +1,288 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+#include "inc_wrapper.h"
+#include "binary_reader.h"
+#include "checksum.h"
+#include "mapped_file.h"
+#include "journal.h"
+
+#include <limits>
+
+// Binary patches for archives, so a texture mod can be shipped as the bytes it changes instead of whole archives.
+// A patch only applies to the exact archive it was made from (size + XXH64), and applying it gives exactly the archive the import would have written.
+//
+// File layout (little endian):
+//   0x00  "DXPT"
+//   0x04  u32 version
+//   0x08  u64 source size
+//   0x10  u64 source XXH64
+//   0x18  u64 target size
+//   0x20  u64 target XXH64
+//   0x28  u32 range count
+//   0x2C  reserved
+//   0x30  ranges: u64 offset, u32 length, u32 reserved, then length bytes of target data
+
+namespace patch
+{
+    const char PATCH_MAGIC[] = "DXPT";
+    const uint32_t PATCH_VERSION = 1;
+    const size_t HEADER_SIZE = 0x30;
+    const size_t RANGE_HEADER_SIZE = 0x10;
+    const char PATCH_EXTENSION[] = ".ddspatch";
+
+    // Unchanged runs shorter than this are kept inside a range, a new range costs more than that in headers
+    const size_t MERGE_GAP = RANGE_HEADER_SIZE;
+
+    struct Range
+    {
+        uint64_t offset = 0;
+        std::vector<u8> data;
+    };
+
+    struct Patch
+    {
+        uint64_t source_size = 0;
+        uint64_t source_hash = 0;
+        uint64_t target_size = 0;
+        uint64_t target_hash = 0;
+        std::vector<Range> ranges;
+    };
+
+    /// <summary>
+    /// Patch file that belongs to an archive: st00.dat -> st00.dat.ddspatch, in the same folder
+    /// </summary>
+    fs::path PatchPathFor(const fs::path& archive_path)
+    {
+        fs::path patch_path = archive_path;
+        patch_path += PATCH_EXTENSION;
+        return patch_path;
+    }
+
+    fs::path ArchivePathFor(const fs::path& patch_path)
+    {
+        return patch_path.parent_path() / patch_path.stem();
+    }
+
+    /// <summary>
+    /// Collects the byte ranges where target differs from source. Bytes past the end of the source are always part of the last range
+    /// </summary>
+    Patch Create(const u8* source, size_t source_size, const u8* target, size_t target_size)
+    {
+        Patch result;
+        result.source_size = source_size;
+        result.source_hash = checksum::XXH64( source, source_size );
+        result.target_size = target_size;
+        result.target_hash = checksum::XXH64( target, target_size );
+
+        size_t common_size = std::min( source_size, target_size );
+        size_t position = 0;
+        while ( position < target_size )
+        {
+            // Skip what's unchanged
+            while ( position < common_size && source[position] == target[position] )
+            {
+                ++position;
+            }
+
+            if ( position >= target_size )
+            {
+                break;
+            }
+
+            // Extend the range until MERGE_GAP unchanged bytes in a row (or the end)
+            size_t range_end = position;
+            size_t unchanged = 0;
+            for ( size_t i = position; i < target_size && unchanged < MERGE_GAP; ++i )
+            {
+                if ( i < common_size && source[i] == target[i] )
+                {
+                    ++unchanged;
+                }
+                else
+                {
+                    unchanged = 0;
+                    range_end = i + 1;
+                }
+            }
+
+            Range range;
+            range.offset = position;
+            range.data.assign( target + position, target + range_end );
+            result.ranges.push_back( std::move( range ) );
+
+            position = range_end;
+        }
+
+        return result;
+    }
+
+    std::vector<u8> Serialize(const Patch& patch)
+    {
+        auto append = [](std::vector<u8>& output, uint64_t value, size_t size)
+        {
+            for ( size_t i = 0; i < size; ++i )
+            {
+                output.push_back( static_cast<u8>( value >> ( i * 8 ) ) );
+            }
+        };
+
+        std::vector<u8> output( PATCH_MAGIC, PATCH_MAGIC + 4 );
+        append( output, PATCH_VERSION, 4 );
+        append( output, patch.source_size, 8 );
+        append( output, patch.source_hash, 8 );
+        append( output, patch.target_size, 8 );
+        append( output, patch.target_hash, 8 );
+        append( output, patch.ranges.size(), 4 );
+        output.resize( HEADER_SIZE, 0 );
+
+        for ( const Range& range : patch.ranges )
+        {
+            append( output, range.offset, 8 );
+            append( output, range.data.size(), 4 );
+            append( output, 0, 4 );
+            output.insert( output.end(), range.data.begin(), range.data.end() );
+        }
+
+        return output;
+    }
+
+    bool Parse(const u8* data, size_t size, Patch& patch)
+    {
+        binary::BinaryReader<binary::Endian::Little> reader( data, size );
+        if ( !reader.MagicAt( 0, PATCH_MAGIC, 4 ) || reader.Read<uint32_t>( 0x04 ) != PATCH_VERSION || !reader.Has( 0, HEADER_SIZE ) )
+        {
+            return false;
+        }
+
+        patch.source_size = reader.Read<uint64_t>( 0x08 );
+        patch.source_hash = reader.Read<uint64_t>( 0x10 );
+        patch.target_size = reader.Read<uint64_t>( 0x18 );
+        patch.target_hash = reader.Read<uint64_t>( 0x20 );
+        if ( patch.target_size > std::numeric_limits<size_t>::max() )
+        {
+            return false;
+        }
+
+        uint32_t range_count = reader.Read<uint32_t>( 0x28 );
+        size_t position = HEADER_SIZE;
+        patch.ranges.clear();
+        for ( uint32_t i = 0; i < range_count; ++i )
+        {
+            if ( !reader.Has( position, RANGE_HEADER_SIZE ) )
+            {
+                return false;
+            }
+
+            Range range;
+            range.offset = reader.Read<uint64_t>( position );
+            size_t length = reader.Read<uint32_t>( position + 8 );
+            position += RANGE_HEADER_SIZE;
+
+            // Written so that a huge offset can't wrap around past the check
+            if ( !reader.Has( position, length ) || range.offset > patch.target_size || length > patch.target_size - range.offset )
+            {
+                return false;
+            }
+
+            range.data.assign( data + position, data + position + length );
+            position += length;
+            patch.ranges.push_back( std::move( range ) );
+        }
+
+        return true;
+    }
+
+    bool Load(const fs::path& patch_path, Patch& patch)
+    {
+        MappedFile file( patch_path );
+        return file.IsValid() && Parse( file.Data(), file.Size(), patch );
+    }
+
+    /// <summary>
+    /// Turns the source archive (or a partially patched one) into the target, in memory
+    /// </summary>
+    void ApplyInMemory(const Patch& patch, std::vector<u8>& data)
+    {
+        data.resize( static_cast<size_t>( patch.target_size ) );
+        for ( const Range& range : patch.ranges )
+        {
+            std::copy( range.data.begin(), range.data.end(), data.begin() + static_cast<size_t>( range.offset ) );
+        }
+    }
+
+    /// <summary>
+    /// Applies a patch to its archive. If the size doesn't change, only the changed ranges are written, in place; otherwise the archive is rewritten in one go.
+    /// An archive that already is the target is left alone, and one that was interrupted halfway through the in-place writes is finished,
+    /// anything else is refused.
+    /// </summary>
+    bool ApplyToFile(const fs::path& patch_path, const fs::path& archive_path, std::string& message)
+    {
+        Patch patch;
+        if ( !Load( patch_path, patch ) )
+        {
+            message = "Error: Not a valid patch: " + patch_path.string();
+            return false;
+        }
+
+        std::vector<u8> rewritten;
+        {
+            MappedFile archive( archive_path );
+            if ( !archive.IsValid() )
+            {
+                message = "Error opening file: " + archive_path.string();
+                return false;
+            }
+
+            uint64_t archive_hash = checksum::XXH64( archive.Data(), archive.Size() );
+            if ( archive.Size() == patch.target_size && archive_hash == patch.target_hash )
+            {
+                message = "Already patched: " + archive_path.string();
+                return true;
+            }
+
+            bool is_source = archive.Size() == patch.source_size && archive_hash == patch.source_hash;
+            if ( !is_source || patch.source_size != patch.target_size )
+            {
+                // Size changes are written as a whole new archive, and a half applied in-place patch can only be told apart by trying
+                rewritten.assign( archive.Data(), archive.Data() + archive.Size() );
+                ApplyInMemory( patch, rewritten );
+                if ( !is_source && checksum::XXH64( rewritten ) != patch.target_hash )
+                {
+                    message = "Error: " + archive_path.string() + " isn't the archive this patch was made for";
+                    return false;
+                }
+            }
+        }
+
+        if ( patch.source_size != patch.target_size )
+        {
+            if ( !journal::WriteFileDurably( archive_path, rewritten.data(), rewritten.size() ) )
+            {
+                message = "Error reopening file for writing: " + archive_path.string();
+                return false;
+            }
+        }
+        else
+        {
+            std::fstream archive( archive_path, std::ios::in | std::ios::out | std::ios::binary );
+            for ( const Range& range : patch.ranges )
+            {
+                archive.seekp( static_cast<std::streamoff>( range.offset ) );
+                archive.write( reinterpret_cast<const char*>( range.data.data() ), range.data.size() );
+            }
+            archive.flush();
+
+            if ( !archive )
+            {
+                message = "Error writing to file: " + archive_path.string();
+                return false;
+            }
+        }
+
+        message = "Patched " + archive_path.string() + " (" + std::to_string( patch.ranges.size() ) + " ranges)";
+        return true;
+    }
+}
+
+#endif
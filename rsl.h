@@ -0,0 +1,236 @@
+#ifndef RSL_H
+#define RSL_H
+
+#include "inc_wrapper.h"
+#include "binary_reader.h"
+
+#include <iomanip>
+
+// RSL resource archives (RMHG containers) from No More Heroes. Members are indexed straight from the mapped archive,
+// so they can be handed to the handlers as views into it without unpacking anything to disk.
+//
+// Layout:
+//   0x00  "RMHG"
+//   0x04  u32 member count
+//   0x08  u32 offset of the member table
+//   table entries: u32 offset, u32 size, followed by fields that aren't needed here
+// The Wii archives are big endian and the PC ones little endian, and the entry size isn't the same everywhere, so every combination is tried.
+// A table read with the wrong entry size can still fit (0x20 byte entries read as 0x10 give every other member plus empty slots), so of the layouts
+// that fit, the one whose members cover the most of the archive is used; layouts that disagree but cover the same amount make the archive ambiguous.
+
+namespace rsl
+{
+    const char RMHG_MAGIC[] = "RMHG";
+    const size_t HEADER_SIZE = 0x10;
+    const size_t MAX_MEMBERS = 0x10000;
+    const size_t MAX_DEPTH = 4;     // RSLs can contain RSLs
+
+    /// <summary>
+    /// One member of an archive, as a view into the mapped archive
+    /// </summary>
+    struct Member
+    {
+        std::string name;       // index path, e.g. "003" or "003_001" for a member of a nested archive
+        const u8* data = nullptr;
+        size_t size = 0;
+    };
+
+    bool IsArchive(const u8* data, size_t size)
+    {
+        return size >= HEADER_SIZE && std::memcmp( data, RMHG_MAGIC, 4 ) == 0;
+    }
+
+    std::string IndexName(size_t index)
+    {
+        std::ostringstream name;
+        name << std::setw( 3 ) << std::setfill( '0' ) << index;
+        return name.str();
+    }
+
+    template <binary::Endian E>
+    bool ReadTable(const u8* data, size_t size, size_t entry_size, std::vector<std::pair<size_t, size_t>>& table)
+    {
+        binary::BinaryReader<E> reader( data, size );
+
+        size_t count = reader.template Read<uint32_t>( 0x04 );
+        size_t table_offset = reader.template Read<uint32_t>( 0x08 );
+        if ( count == 0 || count > MAX_MEMBERS || table_offset < HEADER_SIZE || !reader.Has( table_offset, count * entry_size ) )
+        {
+            return false;
+        }
+
+        size_t table_end = table_offset + count * entry_size;
+
+        table.clear();
+        for ( size_t i = 0; i < count; ++i )
+        {
+            size_t entry = table_offset + i * entry_size;
+            size_t member_offset = reader.template Read<uint32_t>( entry );
+            size_t member_size = reader.template Read<uint32_t>( entry + 4 );
+
+            // Empty slots are allowed, anything else has to be after the table and inside the archive
+            if ( member_size != 0 && ( member_offset < table_end || !reader.Has( member_offset, member_size ) ) )
+            {
+                return false;
+            }
+
+            table.emplace_back( member_offset, member_size );
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Byte order and entry size of a member table
+    /// </summary>
+    struct Layout
+    {
+        binary::Endian endian = binary::Endian::Little;
+        size_t entry_size = 0;
+    };
+
+    std::string ToString(const Layout& layout)
+    {
+        std::ostringstream text;
+        text << ( layout.endian == binary::Endian::Big ? "big" : "little" ) << " endian, 0x" << std::hex << layout.entry_size << " byte entries";
+        return text.str();
+    }
+
+    enum class TableStatus
+    {
+        FOUND,
+        NOT_FOUND,
+        AMBIGUOUS
+    };
+
+    /// <summary>
+    /// Finds the layout of the member table, see the top of the file
+    /// </summary>
+    TableStatus FindTable(const u8* data, size_t size, Layout& layout, std::vector<std::pair<size_t, size_t>>& table)
+    {
+        const size_t ENTRY_SIZES[] = { 0x20, 0x10 };
+
+        if ( !IsArchive( data, size ) )
+        {
+            return TableStatus::NOT_FOUND;
+        }
+
+        auto covered = [](const std::vector<std::pair<size_t, size_t>>& entries)
+        {
+            size_t total = 0;
+            for ( const auto& entry : entries )
+            {
+                total += entry.second;
+            }
+            return total;
+        };
+
+        TableStatus status = TableStatus::NOT_FOUND;
+        size_t best_coverage = 0;
+        for ( size_t entry_size : ENTRY_SIZES )
+        {
+            for ( binary::Endian endian : { binary::Endian::Little, binary::Endian::Big } )
+            {
+                std::vector<std::pair<size_t, size_t>> candidate;
+                bool fits = endian == binary::Endian::Little ? ReadTable<binary::Endian::Little>( data, size, entry_size, candidate ) : ReadTable<binary::Endian::Big>( data, size, entry_size, candidate );
+                if ( !fits )
+                {
+                    continue;
+                }
+
+                size_t coverage = covered( candidate );
+                if ( status == TableStatus::NOT_FOUND || coverage > best_coverage )
+                {
+                    status = TableStatus::FOUND;
+                    best_coverage = coverage;
+                    layout = Layout{ endian, entry_size };
+                    table = std::move( candidate );
+                }
+                else if ( coverage == best_coverage && candidate != table )
+                {
+                    status = TableStatus::AMBIGUOUS;
+                }
+            }
+        }
+
+        return status;
+    }
+
+    /// <summary>
+    /// Adds the members in the table to the list, nested archives are expanded in place
+    /// </summary>
+    bool ReadMembers(const u8* data, size_t size, std::vector<Member>& members, const std::string& prefix = "", size_t depth = 0);
+
+    void AddMembers(const u8* data, const std::vector<std::pair<size_t, size_t>>& table, std::vector<Member>& members, const std::string& prefix, size_t depth)
+    {
+        for ( size_t i = 0; i < table.size(); ++i )
+        {
+            if ( table[i].second == 0 )
+            {
+                continue;
+            }
+
+            Member member;
+            member.name = prefix + IndexName( i );
+            member.data = data + table[i].first;
+            member.size = table[i].second;
+
+            if ( depth + 1 < MAX_DEPTH && ReadMembers( member.data, member.size, members, member.name + "_", depth + 1 ) )
+            {
+                continue;
+            }
+
+            members.push_back( member );
+        }
+    }
+
+    /// <summary>
+    /// Adds the members of the archive to the list, nested archives are expanded in place. Returns false if the member table couldn't be read
+    /// (a nested archive whose table can't be read is kept as one member)
+    /// </summary>
+    bool ReadMembers(const u8* data, size_t size, std::vector<Member>& members, const std::string& prefix, size_t depth)
+    {
+        Layout layout;
+        std::vector<std::pair<size_t, size_t>> table;
+        if ( FindTable( data, size, layout, table ) != TableStatus::FOUND )
+        {
+            return false;
+        }
+
+        AddMembers( data, table, members, prefix, depth );
+        return true;
+    }
+
+    /// <summary>
+    /// ReadMembers for a whole archive file. description says which layout the member table was read with, or why it couldn't be read
+    /// </summary>
+    bool ReadArchive(const u8* data, size_t size, std::vector<Member>& members, std::string& description)
+    {
+        Layout layout;
+        std::vector<std::pair<size_t, size_t>> table;
+        switch ( FindTable( data, size, layout, table ) )
+        {
+            case TableStatus::FOUND:
+                AddMembers( data, table, members, "", 0 );
+                description = std::to_string( table.size() ) + " entries, " + ToString( layout );
+                return true;
+            case TableStatus::AMBIGUOUS:
+                description = "the member table fits more than one layout equally well";
+                return false;
+            default:
+                description = "no layout gives a member table that fits inside the archive";
+                return false;
+        }
+    }
+
+    /// <summary>
+    /// Path that a member is handled as: next to the archive, named after it and the member index (st00.rsl member 3 -> st00_003.bin),
+    /// so whatever a handler writes next to its input ends up next to the archive
+    /// </summary>
+    fs::path MemberPath(const fs::path& archive_path, const Member& member)
+    {
+        return archive_path.parent_path() / ( archive_path.stem().string() + "_" + member.name + ".bin" );
+    }
+}
+
+#endif
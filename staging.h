@@ -0,0 +1,365 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include "inc_wrapper.h"
+#include "checksum.h"
+#include "hash_index.h"
+#include "journal.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "walker.h"
+
+#include <atomic>
+#include <map>
+#include <set>
+
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+#endif
+
+// Fills a Replacement folder with the WIDTHxHEIGHT_hash.dds files written by --extracthashed, without duplicating their data:
+// every texture is hardlinked, or reflinked where the file system refuses the hardlink, and copied otherwise. Neither link works across
+// file systems, so a Replacement folder on another drive always gets copies.
+// The names --stage put into the folder are kept in a manifest there (ddsextractor.staged, one name per line). Only those are ever replaced
+// or removed, textures that were put there by hand (e.g. mods from others) are left alone even if they have the same name as a source.
+
+namespace staging
+{
+    enum class Method
+    {
+        HARDLINK,
+        REFLINK,
+        COPY
+    };
+
+    const char* ToString(Method method)
+    {
+        switch ( method )
+        {
+            case Method::HARDLINK: return "hardlinked";
+            case Method::REFLINK: return "reflinked";
+            case Method::COPY: return "copied";
+            default: return "unknown";
+        }
+    }
+
+    const char MANIFEST_MAGIC[] = "DDSEXTRACTOR_STAGED";
+    const int MANIFEST_VERSION = 1;
+    const char MANIFEST_FILE_NAME[] = "ddsextractor.staged";
+
+    /// <summary>
+    /// Names that an earlier --stage put into the folder. A missing or unreadable manifest is an empty one
+    /// </summary>
+    std::set<std::string> LoadManifest(const fs::path& manifest_path)
+    {
+        std::set<std::string> names;
+        std::ifstream file( manifest_path, std::ios::binary );
+        std::string line;
+        if ( !std::getline( file, line ) || line != std::string( MANIFEST_MAGIC ) + " " + std::to_string( MANIFEST_VERSION ) )
+        {
+            return names;
+        }
+
+        while ( std::getline( file, line ) )
+        {
+            if ( !line.empty() )
+            {
+                names.insert( line );
+            }
+        }
+        return names;
+    }
+
+    bool SaveManifest(const fs::path& manifest_path, const std::set<std::string>& names)
+    {
+        std::string contents = std::string( MANIFEST_MAGIC ) + " " + std::to_string( MANIFEST_VERSION ) + "\n";
+        for ( const std::string& name : names )
+        {
+            contents += name + "\n";
+        }
+        return journal::WriteFileDurably( manifest_path, reinterpret_cast<const u8*>( contents.data() ), contents.size() );
+    }
+
+    /// <summary>
+    /// Counts of what a staging pass did
+    /// </summary>
+    struct Result
+    {
+        std::atomic<size_t> added{ 0 };
+        std::atomic<size_t> updated{ 0 };
+        std::atomic<size_t> hardlinked{ 0 };
+        std::atomic<size_t> reflinked{ 0 };
+        std::atomic<size_t> copied{ 0 };
+        std::atomic<size_t> identical{ 0 };
+        std::atomic<size_t> pruned{ 0 };
+        std::atomic<size_t> kept{ 0 };          // a different texture with the name is in the folder, but not from --stage
+        std::atomic<size_t> failed{ 0 };
+        size_t duplicates = 0;          // sources with a name another source already has
+    };
+
+    bool IsReplacementName(const fs::path& file_path)
+    {
+        return walker::ToLowerASCII( file_path.extension().string() ) == ".dds" && hash_index::IsTextureName( file_path.stem().string() );
+    }
+
+    /// <summary>
+    /// Whether file_path is somewhere inside directory (both as given to fs::weakly_canonical)
+    /// </summary>
+    bool IsInside(const fs::path& file_path, const fs::path& directory)
+    {
+        std::error_code error;
+        fs::path file = fs::weakly_canonical( file_path, error );
+        fs::path root = fs::weakly_canonical( directory, error );
+        auto mismatch = std::mismatch( root.begin(), root.end(), file.begin(), file.end() );
+        return !error && mismatch.first == root.end();
+    }
+
+    /// <summary>
+    /// Copy-on-write clone of a file, sharing the data blocks until either is modified (Btrfs, XFS). Other platforms don't get one here,
+    /// on Windows the copy fallback gets block cloning from CopyFile on volumes that support it (ReFS)
+    /// </summary>
+    bool Reflink(const fs::path& source_path, const fs::path& target_path)
+    {
+#if defined(__linux__) && defined(FICLONE)
+        int source_fd = open( source_path.c_str(), O_RDONLY | O_CLOEXEC );
+        if ( source_fd < 0 )
+        {
+            return false;
+        }
+
+        int target_fd = open( target_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644 );
+        if ( target_fd < 0 )
+        {
+            close( source_fd );
+            return false;
+        }
+
+        bool cloned = ioctl( target_fd, FICLONE, source_fd ) == 0;
+        close( target_fd );
+        close( source_fd );
+        if ( !cloned )
+        {
+            std::error_code error;
+            fs::remove( target_path, error );
+        }
+        return cloned;
+#else
+        (void)source_path;
+        (void)target_path;
+        return false;
+#endif
+    }
+
+    /// <summary>
+    /// Creates target_path (which must not exist) with the contents of source_path, as cheaply as the file system allows
+    /// </summary>
+    bool LinkOrCopy(const fs::path& source_path, const fs::path& target_path, Method& method)
+    {
+        std::error_code error;
+        fs::create_hard_link( source_path, target_path, error );
+        if ( !error )
+        {
+            method = Method::HARDLINK;
+            return true;
+        }
+
+        if ( Reflink( source_path, target_path ) )
+        {
+            method = Method::REFLINK;
+            return true;
+        }
+
+        error.clear();
+        fs::copy_file( source_path, target_path, error );
+        method = Method::COPY;
+        return !error;
+    }
+
+    /// <summary>
+    /// Whether two files have the same contents: the same file (or hardlinks of it), or the same size and XXH64
+    /// </summary>
+    bool SameContents(const fs::path& a_path, const fs::path& b_path)
+    {
+        std::error_code error;
+        if ( fs::equivalent( a_path, b_path, error ) )
+        {
+            return true;
+        }
+
+        MappedFile a( a_path );
+        MappedFile b( b_path );
+        return a.IsValid() && b.IsValid() && a.Size() == b.Size() &&
+               ( a.Size() == 0 || checksum::XXH64( a.Data(), a.Size() ) == checksum::XXH64( b.Data(), b.Size() ) );
+    }
+
+    /// <summary>
+    /// Puts source_path into the Replacement folder as target_path, unless it's already there. A different file with that name is only replaced if --stage
+    /// put it there (owned), by linking to "<name>.tmp" first and renaming it over, so the game never sees a missing or half copied texture.
+    /// Returns whether the name belongs to --stage afterwards. With dry_run nothing is changed, only reported
+    /// </summary>
+    bool StageTexture(const fs::path& source_path, const fs::path& target_path, bool owned, bool dry_run, Result& result)
+    {
+        std::error_code error;
+        bool exists = fs::exists( target_path, error );
+        if ( exists && SameContents( source_path, target_path ) )
+        {
+            ++result.identical;
+            return owned || fs::equivalent( source_path, target_path, error );
+        }
+
+        if ( exists && !owned )
+        {
+            parallel::Log( std::cout, "Kept (not put there by --stage): " + target_path.filename().string() );
+            ++result.kept;
+            return false;
+        }
+
+        if ( dry_run )
+        {
+            parallel::Log( std::cout, std::string( exists ? "Would update: " : "Would add: " ) + target_path.filename().string() );
+            ++( exists ? result.updated : result.added );
+            return true;
+        }
+
+        fs::path temp_path = target_path;
+        temp_path += ".tmp";
+        fs::remove( temp_path, error );
+
+        Method method;
+        if ( !LinkOrCopy( source_path, exists ? temp_path : target_path, method ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not stage " + source_path.string() + " as " + target_path.string() );
+            ++result.failed;
+            return owned;
+        }
+
+        if ( exists )
+        {
+            fs::rename( temp_path, target_path, error );
+            if ( error )
+            {
+                fs::remove( temp_path, error );
+                parallel::Log( std::cerr, "Error: Could not replace " + target_path.string() );
+                ++result.failed;
+                return owned;
+            }
+        }
+
+        switch ( method )
+        {
+            case Method::HARDLINK: ++result.hardlinked; break;
+            case Method::REFLINK: ++result.reflinked; break;
+            case Method::COPY: ++result.copied; break;
+        }
+        ++( exists ? result.updated : result.added );
+        parallel::Log( std::cout, std::string( exists ? "Updated (" : "Added (" ) + ToString( method ) + "): " + target_path.filename().string() );
+        return true;
+    }
+
+    /// <summary>
+    /// Removes a texture --stage put into the folder that no longer has a source. Returns whether the name still belongs to --stage afterwards
+    /// </summary>
+    bool PruneTexture(const fs::path& target_path, bool dry_run, Result& result)
+    {
+        std::error_code error;
+        if ( !fs::exists( target_path, error ) )
+        {
+            return false;
+        }
+
+        if ( dry_run )
+        {
+            parallel::Log( std::cout, "Would remove (no longer extracted): " + target_path.filename().string() );
+            ++result.pruned;
+            return false;
+        }
+
+        if ( !fs::remove( target_path, error ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not remove " + target_path.string() );
+            ++result.failed;
+            return true;
+        }
+
+        parallel::Log( std::cout, "Removed (no longer extracted): " + target_path.filename().string() );
+        ++result.pruned;
+        return false;
+    }
+
+    /// <summary>
+    /// Makes the Replacement textures in target_dir match the ones under source_root (searched recursively, the target itself excluded).
+    /// Staging new and changed textures and removing the stale ones --stage put there earlier is a single parallel pass over the sources and the manifest.
+    /// If a name is found more than once under source_root, the first path in sorted order is used. With dry_run only what would be done is reported
+    /// </summary>
+    void Stage(const fs::path& source_root, const fs::path& target_dir, bool dry_run, Result& result)
+    {
+        std::map<std::string, fs::path> sources;
+        for ( const fs::path& file_path : walker::CollectFiles( source_root, walker::ExtensionSet{ ".dds" } ) )
+        {
+            if ( !IsReplacementName( file_path ) || IsInside( file_path, target_dir ) )
+            {
+                continue;
+            }
+
+            if ( !sources.emplace( file_path.filename().string(), file_path ).second )
+            {
+                ++result.duplicates;
+            }
+        }
+
+        // Most likely the wrong folder, and everything staged earlier would look stale
+        if ( sources.empty() )
+        {
+            parallel::Log( std::cerr, "Error: No Replacement named textures (WIDTHxHEIGHT_hash.dds) in " + source_root.string() + ", nothing was staged or removed" );
+            ++result.failed;
+            return;
+        }
+
+        fs::path manifest_path = target_dir / MANIFEST_FILE_NAME;
+        std::set<std::string> manifest = LoadManifest( manifest_path );
+
+        struct Entry
+        {
+            std::string name;
+            fs::path source_path;       // empty for stale entries
+            bool owned = false;
+        };
+
+        std::vector<Entry> work;
+        for ( const auto& source : sources )
+        {
+            work.push_back( Entry{ source.first, source.second, manifest.count( source.first ) > 0 } );
+        }
+        for ( const std::string& name : manifest )
+        {
+            if ( sources.find( name ) == sources.end() )
+            {
+                work.push_back( Entry{ name, fs::path(), true } );
+            }
+        }
+
+        std::set<std::string> staged;
+        std::mutex staged_mutex;
+        parallel::ForEach( work, [&](const Entry& entry)
+        {
+            fs::path target_path = target_dir / entry.name;
+            bool owned = entry.source_path.empty() ? PruneTexture( target_path, dry_run, result ) : StageTexture( entry.source_path, target_path, entry.owned, dry_run, result );
+            if ( owned )
+            {
+                std::lock_guard<std::mutex> lock( staged_mutex );
+                staged.insert( entry.name );
+            }
+        } );
+
+        if ( !dry_run && staged != manifest && !SaveManifest( manifest_path, staged ) )
+        {
+            parallel::Log( std::cerr, "Error: Could not write " + manifest_path.string() + ", the next --stage won't replace or remove what this one added" );
+            ++result.failed;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,548 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "inc_wrapper.h"
+#include "binary_reader.h"
+
+#include <cmath>
+#include <map>
+#include <mutex>
+
+// Uncompressed images: loading TGA/uncompressed DDS into RGBA, resampling, mipmaps, writing DDS headers and TGA/PPM previews, and comparing images.
+
+namespace texture
+{
+    const size_t DDS_HEADER_SIZE = 128;
+    const uint32_t FOURCC_DXT1 = 0x31545844;   // "DXT1"
+    const uint32_t FOURCC_DXT3 = 0x33545844;   // "DXT3"
+    const uint32_t FOURCC_DXT5 = 0x35545844;   // "DXT5"
+
+    /// <summary>
+    /// 8-bit RGBA image, rows top to bottom
+    /// </summary>
+    struct Image
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<u8> rgba;
+
+        Image() = default;
+        Image(uint32_t width, uint32_t height)
+            : width( width ), height( height ), rgba( static_cast<size_t>( width ) * height * 4 )
+        {
+        }
+
+        bool Empty() const { return width == 0 || height == 0; }
+
+        const u8* Pixel(uint32_t x, uint32_t y) const { return rgba.data() + ( static_cast<size_t>( y ) * width + x ) * 4; }
+        u8* Pixel(uint32_t x, uint32_t y) { return rgba.data() + ( static_cast<size_t>( y ) * width + x ) * 4; }
+
+        bool HasAlpha() const
+        {
+            for ( size_t i = 3; i < rgba.size(); i += 4 )
+            {
+                if ( rgba[i] != 255 )
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    /// <summary>
+    /// Loads an uncompressed (type 2) or RLE (type 10) true color TGA, 24 or 32 bits per pixel
+    /// </summary>
+    bool LoadTGA(const u8* data, size_t size, Image& image)
+    {
+        const size_t TGA_HEADER_SIZE = 18;
+
+        binary::BinaryReader<binary::Endian::Little> reader( data, size );
+        if ( size < TGA_HEADER_SIZE )
+        {
+            return false;
+        }
+
+        u8 id_length = data[0];
+        u8 color_map_type = data[1];
+        u8 image_type = data[2];
+        uint16_t width = reader.Read<uint16_t>( 12 );
+        uint16_t height = reader.Read<uint16_t>( 14 );
+        u8 bits_per_pixel = data[16];
+        u8 descriptor = data[17];
+
+        if ( color_map_type != 0 || ( image_type != 2 && image_type != 10 ) || ( bits_per_pixel != 24 && bits_per_pixel != 32 ) || width == 0 || height == 0 )
+        {
+            return false;
+        }
+
+        size_t bytes_per_pixel = bits_per_pixel / 8;
+        size_t position = TGA_HEADER_SIZE + id_length;
+        size_t pixel_count = static_cast<size_t>( width ) * height;
+
+        // Decode into file order first (BGR(A), bottom-up unless the descriptor says otherwise)
+        std::vector<u8> pixels( pixel_count * 4, 255 );
+        size_t pixel = 0;
+        auto read_pixel = [&](size_t from, size_t to)
+        {
+            pixels[to * 4 + 0] = data[from + 2];
+            pixels[to * 4 + 1] = data[from + 1];
+            pixels[to * 4 + 2] = data[from + 0];
+            if ( bytes_per_pixel == 4 )
+            {
+                pixels[to * 4 + 3] = data[from + 3];
+            }
+        };
+
+        while ( pixel < pixel_count )
+        {
+            if ( image_type == 2 )
+            {
+                if ( position + bytes_per_pixel > size )
+                {
+                    return false;
+                }
+                read_pixel( position, pixel++ );
+                position += bytes_per_pixel;
+                continue;
+            }
+
+            // RLE packets: the top bit says whether the next pixel is repeated or the next pixels are stored as is
+            if ( position >= size )
+            {
+                return false;
+            }
+            u8 packet = data[position++];
+            size_t run = std::min<size_t>( ( packet & 0x7F ) + 1, pixel_count - pixel );
+            bool repeat = ( packet & 0x80 ) != 0;
+
+            for ( size_t i = 0; i < run; ++i )
+            {
+                if ( position + bytes_per_pixel > size )
+                {
+                    return false;
+                }
+                read_pixel( position, pixel++ );
+                if ( !repeat )
+                {
+                    position += bytes_per_pixel;
+                }
+            }
+
+            if ( repeat )
+            {
+                position += bytes_per_pixel;
+            }
+        }
+
+        image = Image( width, height );
+        bool top_down = ( descriptor & 0x20 ) != 0;
+        bool right_to_left = ( descriptor & 0x10 ) != 0;
+        for ( uint32_t y = 0; y < height; ++y )
+        {
+            uint32_t source_y = top_down ? y : height - 1 - y;
+            for ( uint32_t x = 0; x < width; ++x )
+            {
+                uint32_t source_x = right_to_left ? width - 1 - x : x;
+                std::memcpy( image.Pixel( x, y ), &pixels[( static_cast<size_t>( source_y ) * width + source_x ) * 4], 4 );
+            }
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Position of the lowest set bit and the number of bits in a DDS channel mask
+    /// </summary>
+    void MaskShift(uint32_t mask, unsigned& shift, unsigned& bits)
+    {
+        shift = 0;
+        bits = 0;
+        while ( mask != 0 && ( mask & 1 ) == 0 )
+        {
+            mask >>= 1;
+            ++shift;
+        }
+        while ( mask & 1 )
+        {
+            mask >>= 1;
+            ++bits;
+        }
+    }
+
+    u8 ExtractChannel(uint32_t value, uint32_t mask, u8 missing)
+    {
+        if ( mask == 0 )
+        {
+            return missing;
+        }
+
+        unsigned shift;
+        unsigned bits;
+        MaskShift( mask, shift, bits );
+        uint32_t channel = ( value & mask ) >> shift;
+        uint32_t max_value = ( 1u << bits ) - 1;
+        return static_cast<u8>( ( channel * 255 + max_value / 2 ) / max_value );
+    }
+
+    /// <summary>
+    /// Loads the top mip level of an uncompressed (DDPF_RGB) DDS with 16, 24 or 32 bits per pixel
+    /// </summary>
+    bool LoadUncompressedDDS(const u8* data, size_t size, Image& image)
+    {
+        const uint32_t DDPF_ALPHAPIXELS = 0x1;
+        const uint32_t DDPF_RGB = 0x40;
+
+        binary::BinaryReader<binary::Endian::Little> reader( data, size );
+        if ( size < DDS_HEADER_SIZE || !reader.MagicAt( 0, "DDS ", 4 ) )
+        {
+            return false;
+        }
+
+        uint32_t height = reader.Read<uint32_t>( 12 );
+        uint32_t width = reader.Read<uint32_t>( 16 );
+        uint32_t flags = reader.Read<uint32_t>( 80 );
+        uint32_t bit_count = reader.Read<uint32_t>( 88 );
+        uint32_t masks[4] = { reader.Read<uint32_t>( 92 ), reader.Read<uint32_t>( 96 ), reader.Read<uint32_t>( 100 ), reader.Read<uint32_t>( 104 ) };
+
+        if ( !( flags & DDPF_RGB ) || ( bit_count != 16 && bit_count != 24 && bit_count != 32 ) || width == 0 || height == 0 )
+        {
+            return false;
+        }
+
+        size_t bytes_per_pixel = bit_count / 8;
+        if ( !reader.Has( DDS_HEADER_SIZE, static_cast<size_t>( width ) * height * bytes_per_pixel ) )
+        {
+            return false;
+        }
+
+        if ( !( flags & DDPF_ALPHAPIXELS ) )
+        {
+            masks[3] = 0;
+        }
+
+        image = Image( width, height );
+        const u8* pixels = data + DDS_HEADER_SIZE;
+        for ( size_t i = 0; i < static_cast<size_t>( width ) * height; ++i )
+        {
+            uint32_t value = 0;
+            std::memcpy( &value, pixels + i * bytes_per_pixel, bytes_per_pixel );
+            for ( int channel = 0; channel < 4; ++channel )
+            {
+                image.rgba[i * 4 + channel] = ExtractChannel( value, masks[channel], 255 );
+            }
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Bilinear resample, used when a replacement isn't the same size as the texture it replaces
+    /// </summary>
+    Image Resize(const Image& source, uint32_t width, uint32_t height)
+    {
+        if ( source.width == width && source.height == height )
+        {
+            return source;
+        }
+
+        Image result( width, height );
+        for ( uint32_t y = 0; y < height; ++y )
+        {
+            float source_y = std::max( 0.0f, ( y + 0.5f ) * source.height / height - 0.5f );
+            uint32_t y0 = std::min( static_cast<uint32_t>( source_y ), source.height - 1 );
+            uint32_t y1 = std::min( y0 + 1, source.height - 1 );
+            float fy = source_y - y0;
+
+            for ( uint32_t x = 0; x < width; ++x )
+            {
+                float source_x = std::max( 0.0f, ( x + 0.5f ) * source.width / width - 0.5f );
+                uint32_t x0 = std::min( static_cast<uint32_t>( source_x ), source.width - 1 );
+                uint32_t x1 = std::min( x0 + 1, source.width - 1 );
+                float fx = source_x - x0;
+
+                for ( int channel = 0; channel < 4; ++channel )
+                {
+                    float top = source.Pixel( x0, y0 )[channel] * ( 1 - fx ) + source.Pixel( x1, y0 )[channel] * fx;
+                    float bottom = source.Pixel( x0, y1 )[channel] * ( 1 - fx ) + source.Pixel( x1, y1 )[channel] * fx;
+                    result.Pixel( x, y )[channel] = static_cast<u8>( top * ( 1 - fy ) + bottom * fy + 0.5f );
+                }
+            }
+        }
+
+        return result;
+    }
+
+    /// <summary>
+    /// Next mip level: 2x2 box filter, odd edges are clamped
+    /// </summary>
+    Image Downsample(const Image& source)
+    {
+        Image result( std::max( source.width / 2, 1u ), std::max( source.height / 2, 1u ) );
+        for ( uint32_t y = 0; y < result.height; ++y )
+        {
+            uint32_t y0 = std::min( y * 2, source.height - 1 );
+            uint32_t y1 = std::min( y * 2 + 1, source.height - 1 );
+            for ( uint32_t x = 0; x < result.width; ++x )
+            {
+                uint32_t x0 = std::min( x * 2, source.width - 1 );
+                uint32_t x1 = std::min( x * 2 + 1, source.width - 1 );
+                for ( int channel = 0; channel < 4; ++channel )
+                {
+                    unsigned sum = source.Pixel( x0, y0 )[channel] + source.Pixel( x1, y0 )[channel] + source.Pixel( x0, y1 )[channel] + source.Pixel( x1, y1 )[channel];
+                    result.Pixel( x, y )[channel] = static_cast<u8>( ( sum + 2 ) / 4 );
+                }
+            }
+        }
+
+        return result;
+    }
+
+    /// <summary>
+    /// 128-byte header of a block compressed DDS (DXT1/DXT3/DXT5) with the given number of mip levels
+    /// </summary>
+    std::vector<u8> BuildCompressedDDSHeader(uint32_t width, uint32_t height, uint32_t mipmap_count, uint32_t four_cc)
+    {
+        const uint32_t DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000, DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+        const uint32_t DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+        const uint32_t DDPF_FOURCC = 0x4;
+
+        uint32_t block_size = four_cc == FOURCC_DXT1 ? 8 : 16;
+        uint32_t linear_size = std::max( 1u, ( width + 3 ) / 4 ) * std::max( 1u, ( height + 3 ) / 4 ) * block_size;
+
+        std::vector<u8> header( DDS_HEADER_SIZE, 0 );
+        auto put = [&header](size_t offset, uint32_t value)
+        {
+            for ( size_t i = 0; i < 4; ++i )
+            {
+                header[offset + i] = static_cast<u8>( value >> ( i * 8 ) );
+            }
+        };
+
+        put( 0, 0x20534444 );   // "DDS "
+        put( 4, 124 );
+        put( 8, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | ( mipmap_count > 1 ? DDSD_MIPMAPCOUNT : 0 ) );
+        put( 12, height );
+        put( 16, width );
+        put( 20, linear_size );
+        put( 28, mipmap_count > 1 ? mipmap_count : 0 );
+        put( 76, 32 );
+        put( 80, DDPF_FOURCC );
+        put( 84, four_cc );
+        put( 108, DDSCAPS_TEXTURE | ( mipmap_count > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0 ) );
+
+        return header;
+    }
+
+    /// <summary>
+    /// 32-bit uncompressed TGA, stored top to bottom
+    /// </summary>
+    std::vector<u8> EncodeTGA(const Image& image)
+    {
+        std::vector<u8> output( 18, 0 );
+        output[2] = 2;
+        output[12] = static_cast<u8>( image.width );
+        output[13] = static_cast<u8>( image.width >> 8 );
+        output[14] = static_cast<u8>( image.height );
+        output[15] = static_cast<u8>( image.height >> 8 );
+        output[16] = 32;
+        output[17] = 0x28;      // top-left origin, 8 alpha bits
+
+        output.resize( 18 + image.rgba.size() );
+        u8* pixels = output.data() + 18;
+        for ( size_t i = 0; i < image.rgba.size(); i += 4 )
+        {
+            pixels[i + 0] = image.rgba[i + 2];
+            pixels[i + 1] = image.rgba[i + 1];
+            pixels[i + 2] = image.rgba[i + 0];
+            pixels[i + 3] = image.rgba[i + 3];
+        }
+
+        return output;
+    }
+
+    /// <summary>
+    /// Binary PPM (P6). PPM has no alpha, so it's dropped
+    /// </summary>
+    std::vector<u8> EncodePPM(const Image& image)
+    {
+        std::string header = "P6\n" + std::to_string( image.width ) + " " + std::to_string( image.height ) + "\n255\n";
+
+        std::vector<u8> output( header.begin(), header.end() );
+        output.reserve( output.size() + static_cast<size_t>( image.width ) * image.height * 3 );
+        for ( size_t i = 0; i < image.rgba.size(); i += 4 )
+        {
+            output.insert( output.end(), image.rgba.begin() + i, image.rgba.begin() + i + 3 );
+        }
+
+        return output;
+    }
+
+    /// <summary>
+    /// Scales an image down to fit in max_size x max_size, keeping its aspect ratio. Box filtered halvings first, so large textures don't alias
+    /// </summary>
+    Image Thumbnail(const Image& source, uint32_t max_size)
+    {
+        Image result = source;
+        while ( result.width >= max_size * 2 || result.height >= max_size * 2 )
+        {
+            result = Downsample( result );
+        }
+
+        if ( result.width <= max_size && result.height <= max_size )
+        {
+            return result;
+        }
+
+        float scale = static_cast<float>( max_size ) / std::max( result.width, result.height );
+        return Resize( result, std::max( 1u, static_cast<uint32_t>( result.width * scale + 0.5f ) ), std::max( 1u, static_cast<uint32_t>( result.height * scale + 0.5f ) ) );
+    }
+
+    /// <summary>
+    /// How far apart two images of the same size are
+    /// </summary>
+    struct DiffStats
+    {
+        double psnr_rgb = 0.0;      // infinity when identical
+        double psnr_alpha = 0.0;
+        int max_error = 0;          // largest difference of any channel
+        size_t differing_pixels = 0;
+    };
+
+    double PSNR(double squared_error, size_t samples)
+    {
+        if ( squared_error == 0.0 || samples == 0 )
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        return 10.0 * std::log10( 255.0 * 255.0 / ( squared_error / samples ) );
+    }
+
+    DiffStats Compare(const Image& a, const Image& b)
+    {
+        DiffStats stats;
+        double squared_rgb = 0.0;
+        double squared_alpha = 0.0;
+        for ( size_t i = 0; i < a.rgba.size() && i < b.rgba.size(); i += 4 )
+        {
+            bool differs = false;
+            for ( int channel = 0; channel < 4; ++channel )
+            {
+                int difference = std::abs( a.rgba[i + channel] - b.rgba[i + channel] );
+                ( channel < 3 ? squared_rgb : squared_alpha ) += difference * difference;
+                stats.max_error = std::max( stats.max_error, difference );
+                differs |= difference != 0;
+            }
+            stats.differing_pixels += differs ? 1 : 0;
+        }
+
+        size_t pixel_count = std::min( a.rgba.size(), b.rgba.size() ) / 4;
+        stats.psnr_rgb = PSNR( squared_rgb, pixel_count * 3 );
+        stats.psnr_alpha = PSNR( squared_alpha, pixel_count );
+        return stats;
+    }
+
+    /// <summary>
+    /// Per-pixel absolute difference, scaled up so small errors are visible. Alpha is made opaque
+    /// </summary>
+    Image DiffImage(const Image& a, const Image& b, int scale = 8)
+    {
+        Image result( a.width, a.height );
+        for ( size_t i = 0; i < result.rgba.size() && i < b.rgba.size(); i += 4 )
+        {
+            int alpha_difference = std::abs( a.rgba[i + 3] - b.rgba[i + 3] );
+            for ( int channel = 0; channel < 3; ++channel )
+            {
+                int difference = std::max( std::abs( a.rgba[i + channel] - b.rgba[i + channel] ), alpha_difference );
+                result.rgba[i + channel] = static_cast<u8>( std::min( difference * scale, 255 ) );
+            }
+            result.rgba[i + 3] = 255;
+        }
+        return result;
+    }
+
+    /// <summary>
+    /// Collects thumbnails (from any number of threads) and lays them out in a grid, in name order.
+    /// Pages hold columns x columns thumbnails, so a folder with thousands of textures gives several sheets instead of one enormous image
+    /// </summary>
+    class ContactSheet
+    {
+    public:
+        /// <summary>
+        /// Pages are meant to be saved as output_stem + "_000.tga" etc.
+        /// </summary>
+        explicit ContactSheet(const fs::path& output_stem, uint32_t cell_size = 128, uint32_t columns = 16)
+            : output_stem( output_stem ), cell_size( cell_size ), columns( columns )
+        {
+        }
+
+        const fs::path& OutputStem() const { return output_stem; }
+
+        /// <summary>
+        /// Adds (or replaces) the thumbnail of a texture
+        /// </summary>
+        void Add(const std::string& name, const Image& image)
+        {
+            Image thumbnail = Thumbnail( image, cell_size );
+
+            std::lock_guard<std::mutex> lock( mutex );
+            thumbnails[name] = std::move( thumbnail );
+        }
+
+        size_t Count() const
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            return thumbnails.size();
+        }
+
+        std::vector<Image> Pages() const
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+
+            const size_t PER_PAGE = static_cast<size_t>( columns ) * columns;
+            std::vector<Image> pages;
+
+            size_t index = 0;
+            for ( const auto& entry : thumbnails )
+            {
+                size_t slot = index++ % PER_PAGE;
+                if ( slot == 0 )
+                {
+                    size_t remaining = thumbnails.size() - ( index - 1 );
+                    uint32_t rows = static_cast<uint32_t>( ( std::min( remaining, PER_PAGE ) + columns - 1 ) / columns );
+                    uint32_t used_columns = static_cast<uint32_t>( std::min<size_t>( remaining, columns ) );
+                    pages.emplace_back( used_columns * cell_size, rows * cell_size );
+                }
+
+                // Centered in its cell, on black
+                Image& page = pages.back();
+                const Image& thumbnail = entry.second;
+                uint32_t left = static_cast<uint32_t>( slot % columns ) * cell_size + ( cell_size - thumbnail.width ) / 2;
+                uint32_t top = static_cast<uint32_t>( slot / columns ) * cell_size + ( cell_size - thumbnail.height ) / 2;
+                for ( uint32_t y = 0; y < thumbnail.height; ++y )
+                {
+                    std::memcpy( page.Pixel( left, top + y ), thumbnail.Pixel( 0, y ), static_cast<size_t>( thumbnail.width ) * 4 );
+                }
+            }
+
+            for ( Image& page : pages )
+            {
+                for ( size_t i = 3; i < page.rgba.size(); i += 4 )
+                {
+                    page.rgba[i] = 255;
+                }
+            }
+
+            return pages;
+        }
+
+    private:
+        fs::path output_stem;
+        uint32_t cell_size;
+        uint32_t columns;
+        mutable std::mutex mutex;
+        std::map<std::string, Image> thumbnails;
+    };
+}
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef WALKER_H
+#define WALKER_H
+
+#include "inc_wrapper.h"
+#include "parallel.h"
+
+#include <cerrno>
+#include <unordered_set>
+#include <functional>
+#include <system_error>
+#include <initializer_list>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+namespace walker
+{
+    std::string ToLowerASCII(std::string text)
+    {
+        std::transform( text.begin(), text.end(), text.begin(), [](char c) { return ( c >= 'A' && c <= 'Z' ) ? static_cast<char>( c - 'A' + 'a' ) : c; } );
+        return text;
+    }
+
+    /// <summary>
+    /// Case-insensitive set of file extensions (with the dot, e.g. ".bin"), so ".BIN", ".Bin" and ".bin" all match without listing them separately
+    /// </summary>
+    class ExtensionSet
+    {
+    public:
+        ExtensionSet() = default;
+
+        ExtensionSet(std::initializer_list<std::string> list)
+        {
+            for ( const auto& extension : list )
+            {
+                Add( extension );
+            }
+        }
+
+        explicit ExtensionSet(const std::vector<std::string>& list)
+        {
+            for ( const auto& extension : list )
+            {
+                Add( extension );
+            }
+        }
+
+        /// <summary>
+        /// A set that matches every file, used when files are picked by their contents instead
+        /// </summary>
+        static ExtensionSet Any()
+        {
+            ExtensionSet set;
+            set.match_any = true;
+            return set;
+        }
+
+        void Add(const std::string& extension)
+        {
+            extensions.insert( ToLowerASCII( extension ) );
+        }
+
+        bool Empty() const { return extensions.empty() && !match_any; }
+
+        /// <summary>
+        /// Matches the extension of a file name the same way fs::path::extension() splits it (a leading dot alone isn't an extension)
+        /// </summary>
+        bool MatchesName(const std::string& file_name) const
+        {
+            if ( match_any )
+            {
+                return true;
+            }
+
+            size_t dot = file_name.find_last_of( '.' );
+            if ( dot == std::string::npos || dot == 0 )
+            {
+                return false;
+            }
+
+            return extensions.count( ToLowerASCII( file_name.substr( dot ) ) ) > 0;
+        }
+
+        bool Matches(const fs::path& file_path) const
+        {
+            return MatchesName( file_path.filename().string() );
+        }
+
+    private:
+        std::unordered_set<std::string> extensions;
+        bool match_any = false;
+    };
+
+    /// <summary>
+    /// Lists one directory: matching files go to on_file, subdirectories to on_directory.
+    /// The entry type comes from the directory listing itself (d_type / find data attributes), so files aren't stat'ed one by one.
+    /// Symlinked directories aren't followed, same as fs::recursive_directory_iterator. Returns false with error set if the directory can't be opened
+    /// </summary>
+    template <typename FileFn, typename DirectoryFn>
+    bool ListDirectory(const fs::path& directory, const ExtensionSet& extensions, FileFn&& on_file, DirectoryFn&& on_directory, std::error_code& error)
+    {
+#if defined(_WIN32)
+        WIN32_FIND_DATAW find_data;
+        HANDLE find_handle = FindFirstFileExW( ( directory / L"*" ).wstring().c_str(), FindExInfoBasic, &find_data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH );
+        if ( find_handle == INVALID_HANDLE_VALUE )
+        {
+            error = std::error_code( static_cast<int>( GetLastError() ), std::system_category() );
+            return false;
+        }
+
+        do
+        {
+            const wchar_t* name = find_data.cFileName;
+            if ( name[0] == L'.' && ( name[1] == L'\0' || ( name[1] == L'.' && name[2] == L'\0' ) ) )
+            {
+                continue;
+            }
+
+            if ( find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY )
+            {
+                if ( !( find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT ) )
+                {
+                    on_directory( directory / name );
+                }
+            }
+            else
+            {
+                fs::path file_path = directory / name;
+                if ( extensions.Matches( file_path ) )
+                {
+                    on_file( std::move( file_path ) );
+                }
+            }
+        } while ( FindNextFileW( find_handle, &find_data ) );
+
+        FindClose( find_handle );
+        return true;
+#else
+        // readdir is a thin wrapper around getdents64 and already hands back d_type
+        DIR* dir = opendir( directory.c_str() );
+        if ( dir == nullptr )
+        {
+            error = std::error_code( errno, std::generic_category() );
+            return false;
+        }
+
+        while ( dirent* entry = readdir( dir ) )
+        {
+            const char* name = entry->d_name;
+            if ( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) )
+            {
+                continue;
+            }
+
+            unsigned char type = entry->d_type;
+            if ( type == DT_UNKNOWN || type == DT_LNK )
+            {
+                // Some filesystems don't fill in d_type, and symlinks to files still count as files
+                struct stat info;
+                fs::path entry_path = directory / name;
+                if ( type == DT_UNKNOWN && lstat( entry_path.c_str(), &info ) == 0 && S_ISDIR( info.st_mode ) )
+                {
+                    type = DT_DIR;
+                }
+                else if ( stat( entry_path.c_str(), &info ) == 0 && S_ISREG( info.st_mode ) )
+                {
+                    type = DT_REG;
+                }
+            }
+
+            if ( type == DT_DIR )
+            {
+                on_directory( directory / name );
+            }
+            else if ( type == DT_REG && extensions.MatchesName( name ) )
+            {
+                on_file( directory / name );
+            }
+        }
+
+        closedir( dir );
+        return true;
+#endif
+    }
+
+    /// <summary>
+    /// Walks a directory tree with several threads and calls on_file for every file with a matching extension as soon as it's found.
+    /// on_file is called from the walker threads, so it has to be thread-safe (pushing into a parallel::WorkQueue is the usual choice).
+    /// Throws fs::filesystem_error if root can't be listed (like fs::directory_iterator), subdirectories that can't be opened are skipped.
+    /// </summary>
+    void Walk(const fs::path& root, const ExtensionSet& extensions, const std::function<void(const fs::path&)>& on_file)
+    {
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<fs::path> directories;
+        size_t busy = 0;
+
+        // The root is listed up front, so a mistyped path is an error instead of a walk that finds nothing
+        std::error_code error;
+        if ( !ListDirectory( root, extensions, on_file, [&](fs::path&& subdirectory) { directories.push_back( std::move( subdirectory ) ); }, error ) )
+        {
+            throw fs::filesystem_error( "Could not open directory", root, error );
+        }
+
+        auto worker = [&]()
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            while ( true )
+            {
+                ready.wait( lock, [&]() { return !directories.empty() || busy == 0; } );
+                if ( directories.empty() )
+                {
+                    // Nothing queued and nobody is listing a directory that could add more
+                    return;
+                }
+
+                fs::path directory = std::move( directories.back() );
+                directories.pop_back();
+                ++busy;
+                lock.unlock();
+
+                std::vector<fs::path> subdirectories;
+                std::error_code list_error;
+                ListDirectory( directory, extensions, on_file, [&](fs::path&& subdirectory) { subdirectories.push_back( std::move( subdirectory ) ); }, list_error );
+
+                lock.lock();
+                --busy;
+                for ( auto& subdirectory : subdirectories )
+                {
+                    directories.push_back( std::move( subdirectory ) );
+                }
+                ready.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for ( unsigned i = 1; i < parallel::WorkerCount(); ++i )
+        {
+            threads.emplace_back( worker );
+        }
+        worker();
+
+        for ( auto& thread : threads )
+        {
+            thread.join();
+        }
+    }
+
+    /// <summary>
+    /// Walks the whole tree first and returns every matching file. For modes that rename or create files with matching extensions while running.
+    /// Throws like Walk.
+    /// </summary>
+    std::vector<fs::path> CollectFiles(const fs::path& root, const ExtensionSet& extensions)
+    {
+        std::mutex mutex;
+        std::vector<fs::path> files;
+        Walk( root, extensions, [&](const fs::path& file_path)
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            files.push_back( file_path );
+        } );
+
+        // Walk order depends on thread timing, sort so runs are reproducible
+        std::sort( files.begin(), files.end() );
+        return files;
+    }
+}
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+
+#include "inc_wrapper.h"
+
+#include <map>
+#include <thread>
+#include <chrono>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <sys/inotify.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+namespace watcher
+{
+    /// <summary>
+    /// Reports files that were created, written or moved into a directory tree.
+    /// Uses ReadDirectoryChangesW on Windows and inotify on Linux, anything else falls back to comparing directory snapshots.
+    /// When the OS drops events (queue overflow) NeedsRescan() turns true and the caller should process the whole tree again.
+    /// </summary>
+    class DirectoryWatcher
+    {
+    public:
+        explicit DirectoryWatcher(const fs::path& directory)
+            : root( directory )
+        {
+#if defined(_WIN32)
+            directory_handle = CreateFileW( directory.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr );
+            overlapped.hEvent = CreateEventW( nullptr, TRUE, FALSE, nullptr );
+            valid = directory_handle != INVALID_HANDLE_VALUE && overlapped.hEvent != nullptr && IssueRead();
+#elif defined(__linux__)
+            inotify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+            valid = inotify_fd >= 0 && AddWatchRecursive( directory, nullptr );
+#else
+            TakeSnapshot( snapshot );
+            valid = true;
+#endif
+        }
+
+        ~DirectoryWatcher()
+        {
+#if defined(_WIN32)
+            if ( directory_handle != INVALID_HANDLE_VALUE )
+            {
+                CancelIo( directory_handle );
+                CloseHandle( directory_handle );
+            }
+            if ( overlapped.hEvent != nullptr )
+            {
+                CloseHandle( overlapped.hEvent );
+            }
+#elif defined(__linux__)
+            if ( inotify_fd >= 0 )
+            {
+                close( inotify_fd );
+            }
+#endif
+        }
+
+        DirectoryWatcher(const DirectoryWatcher&) = delete;
+        DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+        bool IsValid() const { return valid; }
+
+        bool NeedsRescan()
+        {
+            bool result = rescan;
+            rescan = false;
+            return result;
+        }
+
+        /// <summary>
+        /// Waits up to timeout_ms for changes and appends the paths of changed files. Paths may repeat, callers are expected to coalesce them.
+        /// </summary>
+        void WaitForChanges(int timeout_ms, std::vector<fs::path>& changed)
+        {
+#if defined(_WIN32)
+            if ( WaitForSingleObject( overlapped.hEvent, static_cast<DWORD>( timeout_ms ) ) != WAIT_OBJECT_0 )
+            {
+                return;
+            }
+
+            DWORD bytes = 0;
+            if ( !GetOverlappedResult( directory_handle, &overlapped, &bytes, FALSE ) || bytes == 0 )
+            {
+                // Buffer overflowed, individual changes are lost
+                rescan = true;
+            }
+            else
+            {
+                const u8* event_ptr = reinterpret_cast<const u8*>( event_buffer );
+                while ( true )
+                {
+                    const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>( event_ptr );
+                    if ( info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_RENAMED_NEW_NAME )
+                    {
+                        changed.push_back( root / std::wstring( info->FileName, info->FileNameLength / sizeof( WCHAR ) ) );
+                    }
+
+                    if ( info->NextEntryOffset == 0 )
+                    {
+                        break;
+                    }
+                    event_ptr += info->NextEntryOffset;
+                }
+            }
+
+            ResetEvent( overlapped.hEvent );
+            valid = IssueRead();
+#elif defined(__linux__)
+            pollfd poll_fd = { inotify_fd, POLLIN, 0 };
+            if ( poll( &poll_fd, 1, timeout_ms ) <= 0 )
+            {
+                return;
+            }
+
+            alignas( inotify_event ) char buffer[64 * 1024];
+            ssize_t length;
+            while ( ( length = read( inotify_fd, buffer, sizeof( buffer ) ) ) > 0 )
+            {
+                for ( char* event_ptr = buffer; event_ptr < buffer + length; )
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>( event_ptr );
+                    event_ptr += sizeof( inotify_event ) + event->len;
+
+                    if ( event->mask & IN_Q_OVERFLOW )
+                    {
+                        rescan = true;
+                        continue;
+                    }
+
+                    // The kernel dropped the watch (the directory was deleted, or its file system unmounted)
+                    if ( event->mask & IN_IGNORED )
+                    {
+                        watched_directories.erase( event->wd );
+                        continue;
+                    }
+
+                    auto directory_it = watched_directories.find( event->wd );
+                    if ( directory_it == watched_directories.end() || event->len == 0 )
+                    {
+                        continue;
+                    }
+
+                    fs::path event_path = directory_it->second / event->name;
+                    if ( event->mask & IN_ISDIR )
+                    {
+                        // New folders need their own watch, anything that was already copied into them is reported right away
+                        if ( event->mask & ( IN_CREATE | IN_MOVED_TO ) )
+                        {
+                            AddWatchRecursive( event_path, &changed );
+                        }
+                        else if ( event->mask & IN_MOVED_FROM )
+                        {
+                            // A folder moved out of the tree keeps its watches, so they'd report changes under a path that's gone
+                            RemoveWatchesUnder( event_path );
+                        }
+                    }
+                    else if ( event->mask & ( IN_CLOSE_WRITE | IN_MOVED_TO ) )
+                    {
+                        changed.push_back( event_path );
+                    }
+                }
+            }
+#else
+            std::this_thread::sleep_for( std::chrono::milliseconds( std::min( timeout_ms, 500 ) ) );
+
+            std::map<fs::path, std::pair<uintmax_t, fs::file_time_type>> current;
+            TakeSnapshot( current );
+            for ( const auto& [path, state] : current )
+            {
+                auto previous = snapshot.find( path );
+                if ( previous == snapshot.end() || previous->second != state )
+                {
+                    changed.push_back( path );
+                }
+            }
+            snapshot.swap( current );
+#endif
+        }
+
+    private:
+        fs::path root;
+        bool valid = false;
+        bool rescan = false;
+
+#if defined(_WIN32)
+        HANDLE directory_handle = INVALID_HANDLE_VALUE;
+        OVERLAPPED overlapped = {};
+        DWORD event_buffer[16 * 1024];
+
+        bool IssueRead()
+        {
+            return ReadDirectoryChangesW( directory_handle, event_buffer, sizeof( event_buffer ), TRUE,
+                                          FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                                          nullptr, &overlapped, nullptr ) != FALSE;
+        }
+#elif defined(__linux__)
+        int inotify_fd = -1;
+        std::map<int, fs::path> watched_directories;
+
+        bool AddWatch(const fs::path& directory)
+        {
+            int wd = inotify_add_watch( inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE );
+            if ( wd < 0 )
+            {
+                return false;
+            }
+
+            watched_directories[wd] = directory;
+            return true;
+        }
+
+        void RemoveWatchesUnder(const fs::path& directory)
+        {
+            for ( auto it = watched_directories.begin(); it != watched_directories.end(); )
+            {
+                auto mismatch = std::mismatch( directory.begin(), directory.end(), it->second.begin(), it->second.end() );
+                if ( mismatch.first == directory.end() )
+                {
+                    inotify_rm_watch( inotify_fd, it->first );
+                    it = watched_directories.erase( it );
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        bool AddWatchRecursive(const fs::path& directory, std::vector<fs::path>* existing_files)
+        {
+            if ( !AddWatch( directory ) )
+            {
+                return false;
+            }
+
+            std::error_code error;
+            for ( fs::recursive_directory_iterator it( directory, error ), end; !error && it != end; it.increment( error ) )
+            {
+                if ( it->is_directory( error ) )
+                {
+                    AddWatch( it->path() );
+                }
+                else if ( existing_files != nullptr && it->is_regular_file( error ) )
+                {
+                    existing_files->push_back( it->path() );
+                }
+            }
+
+            return true;
+        }
+#else
+        std::map<fs::path, std::pair<uintmax_t, fs::file_time_type>> snapshot;
+
+        void TakeSnapshot(std::map<fs::path, std::pair<uintmax_t, fs::file_time_type>>& result)
+        {
+            std::error_code error;
+            for ( fs::recursive_directory_iterator it( root, error ), end; !error && it != end; it.increment( error ) )
+            {
+                if ( it->is_regular_file( error ) )
+                {
+                    result[it->path()] = { it->file_size( error ), it->last_write_time( error ) };
+                }
+            }
+        }
+#endif
+    };
+}
+
+#endif